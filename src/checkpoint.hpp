@@ -0,0 +1,159 @@
+/*
+   ____ _               _                _       _
+  / ___| |__   ___  ___| | ___ __   ___ (_)_ __ | |_
+ | |   | '_ \ / _ \/ __| |/ / '_ \ / _ \| | '_ \| __|
+ | |___| | | |  __/ (__|   <| |_) | (_) | | | | | |_
+  \____|_| |_|\___|\___|_|\_\ .__/ \___/|_|_| |_|\__|
+                            |_|
+ Checkpointer class, saving and restoring the state of filters
+*/
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include "common.hpp"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*!
+ * Periodic checkpoints of a filter state, for warm restarts
+ *
+ * The state returned by Filter::save_state() is written to a file with a
+ * small header (magic, filter kind, length and FNV-1a hash of the state), to
+ * a temporary file first, then synced and renamed over the previous
+ * checkpoint, so that a crash never leaves a torn checkpoint. restore()
+ * passes the state to Filter::load_state() if the kind matches and the hash
+ * is valid.
+ *
+ * Agents call restore() after set_params(), tick() after each process(),
+ * and save() at shutdown.
+ */
+class Checkpointer {
+  static constexpr char MAGIC[8] = {'M', 'A', 'D', 'S', 'C', 'K', 'P', '1'};
+
+public:
+  using clock = std::chrono::steady_clock;
+
+  Checkpointer(std::filesystem::path path, std::chrono::milliseconds interval = std::chrono::milliseconds(10000))
+      : _path(path), _interval(interval), _last(clock::now()) {}
+
+  /*!
+   * Loads the last checkpoint into the filter. Returns false if there is
+   * none, or if it is invalid or for another kind of filter.
+   */
+  template <class F> bool restore(F &filter) {
+    std::ifstream ifs(_path, std::ios::binary);
+    if (!ifs.is_open()) return fail("not found");
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(ifs)),
+                                    std::istreambuf_iterator<char>());
+    std::string kind = filter.kind();
+    size_t pos = sizeof(MAGIC);
+    uint32_t kind_len;
+    uint64_t len, h;
+    if (file.size() < pos + sizeof(kind_len) || std::memcmp(file.data(), MAGIC, sizeof(MAGIC)) != 0)
+      return fail("not a checkpoint");
+    std::memcpy(&kind_len, file.data() + pos, sizeof(kind_len));
+    pos += sizeof(kind_len);
+    if (file.size() < pos + kind_len + sizeof(len) + sizeof(h)) return fail("truncated");
+    if (std::string(file.begin() + pos, file.begin() + pos + kind_len) != kind)
+      return fail("saved by another kind of filter");
+    pos += kind_len;
+    std::memcpy(&len, file.data() + pos, sizeof(len));
+    pos += sizeof(len);
+    std::memcpy(&h, file.data() + pos, sizeof(h));
+    pos += sizeof(h);
+    if (file.size() - pos != len) return fail("truncated");
+    std::vector<unsigned char> state(file.begin() + pos, file.end());
+    if (hash(state) != h) return fail("corrupted");
+    if (filter.load_state(state) != return_type::success) return fail(filter.error());
+    _bytes = file.size();
+    return true;
+  }
+
+  /*!
+   * Saves a checkpoint if the interval has elapsed since the last one
+   */
+  template <class F> bool tick(F &filter) {
+    if (_interval.count() <= 0 || clock::now() - _last < _interval) return false;
+    return save(filter);
+  }
+
+  /*!
+   * Saves a checkpoint of the filter state
+   */
+  template <class F> bool save(F &filter) {
+    _last = clock::now();
+    std::vector<unsigned char> state;
+    if (filter.save_state(state) != return_type::success) return fail(filter.error());
+    std::string kind = filter.kind();
+    uint32_t kind_len = static_cast<uint32_t>(kind.size());
+    uint64_t len = state.size(), h = hash(state);
+    std::filesystem::path tmp = _path;
+    tmp += ".tmp";
+    std::error_code ec;
+    if (_path.has_parent_path()) std::filesystem::create_directories(_path.parent_path(), ec);
+    FILE *f = fopen(tmp.string().c_str(), "wb");
+    if (!f) return fail("cannot write " + tmp.string());
+    bool ok = fwrite(MAGIC, sizeof(MAGIC), 1, f) == 1 &&
+              fwrite(&kind_len, sizeof(kind_len), 1, f) == 1 &&
+              fwrite(kind.data(), 1, kind.size(), f) == kind.size() &&
+              fwrite(&len, sizeof(len), 1, f) == 1 && fwrite(&h, sizeof(h), 1, f) == 1 &&
+              fwrite(state.data(), 1, state.size(), f) == state.size();
+    fflush(f);
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+    fclose(f);
+    if (!ok) return fail("cannot write " + tmp.string());
+    std::filesystem::rename(tmp, _path, ec);
+    if (ec) return fail(ec.message());
+    _bytes = sizeof(MAGIC) + sizeof(kind_len) + kind.size() + sizeof(len) + sizeof(h) + len;
+    _saved++;
+    _duration = std::chrono::duration<double, std::milli>(clock::now() - _last).count();
+    return true;
+  }
+
+  std::filesystem::path path() const { return _path; }
+  std::string error() const { return _error; }
+  size_t saved() const { return _saved; }
+  size_t bytes() const { return _bytes; }         // of the last checkpoint
+  double duration() const { return _duration; }   // ms, of the last save
+
+private:
+  bool fail(const std::string &reason) {
+    _error = "Checkpoint " + _path.string() + ": " + reason;
+    return false;
+  }
+
+  static uint64_t hash(const std::vector<unsigned char> &data) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+      h ^= c;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  std::filesystem::path _path;
+  std::chrono::milliseconds _interval;
+  clock::time_point _last;
+  std::string _error;
+  size_t _saved = 0, _bytes = 0;
+  double _duration = 0;
+};
+
+#endif // CHECKPOINT_HPP
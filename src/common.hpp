@@ -1,13 +1,37 @@
 #ifndef COMMON_HPP
 #define COMMON_HPP
 
-#define PLUGIN_PROTOCOL_VERSION 7
+#define PLUGIN_PROTOCOL_VERSION 10
 
 /*!
 * @file common.hpp
 * @brief Common definitions for the pugg library
 */
 
+/*!
+* @def REGISTER_DRIVER(klass)
+* Makes the driver of a plugin class available to the kernel.
+*
+* @brief Used by the INSTALL_*_DRIVER macros. Normally, it defines the
+* `register_pugg_plugin()` entry point called by pugg::Kernel::load_plugin().
+* When the plugin is compiled into an executable (MADS_STATIC_PLUGIN
+* defined, see registry.hpp), it adds the driver to the static Registry
+* instead.
+* @param klass the class name
+*/
+#ifdef MADS_STATIC_PLUGIN
+#include "registry.hpp"
+#define REGISTER_DRIVER(klass)                                                 \
+  static Registry::Registrar klass##Registrar(                                 \
+    klass::server_name(), PLUGIN_NAME,                                         \
+    [](pugg::Kernel *kernel) { kernel->add_driver(new klass##Driver()); });
+#else
+#define REGISTER_DRIVER(klass)                                                 \
+  extern "C" EXPORTIT void register_pugg_plugin(pugg::Kernel *kernel) {        \
+    kernel->add_driver(new klass##Driver());                                   \
+  }
+#endif
+
 
 /*!
 * @def INSTALL_SOURCE_DRIVER(klass, type)
@@ -24,9 +48,7 @@
     klass##Driver() : SourceDriver(PLUGIN_NAME, klass::version) {}             \
     Source<type> *create() { return new klass(); }                             \
   };                                                                           \
-  extern "C" EXPORTIT void register_pugg_plugin(pugg::Kernel *kernel) {        \
-    kernel->add_driver(new klass##Driver());                                   \
-  }
+  REGISTER_DRIVER(klass)
 
 /*!
 * \def INSTALL_FILTER_DRIVER(klass, type_in, type_out)
@@ -42,10 +64,16 @@
   public:                                                                      \
     klass##Driver() : FilterDriver(PLUGIN_NAME, klass::version) {}             \
     Filter<type_in, type_out> *create() { return new klass(); }                \
+    std::vector<std::string> capabilities() override {                         \
+      using SaveState = return_type (Filter<type_in, type_out>::*)(            \
+        std::vector<unsigned char> &);                                         \
+      if constexpr (std::is_same_v<decltype(&klass::save_state), SaveState>)   \
+        return {};                                                             \
+      else                                                                     \
+        return {"checkpoint"};                                                 \
+    }                                                                          \
   };                                                                           \
-  extern "C" EXPORTIT void register_pugg_plugin(pugg::Kernel *kernel) {        \
-    kernel->add_driver(new klass##Driver());                                   \
-  }
+  REGISTER_DRIVER(klass)
 
 /*!
 * @def INSTALL_SINK_DRIVER(klass, type)
@@ -62,9 +90,7 @@
     klass##Driver() : SinkDriver(PLUGIN_NAME, klass::version) {}             \
     Sink<type> *create() { return new klass(); }                             \
   };                                                                           \
-  extern "C" EXPORTIT void register_pugg_plugin(pugg::Kernel *kernel) {        \
-    kernel->add_driver(new klass##Driver());                                   \
-  }
+  REGISTER_DRIVER(klass)
 
 /*!
 * @brief The return type of common interface functions.
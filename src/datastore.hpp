@@ -5,47 +5,109 @@
  | |_| | (_| | || (_| \__ \ || (_) | | |  __/
  |____/ \__,_|\__\__,_|___/\__\___/|_|  \___|
                                              
- Datastore class, implementing persistency on a JSON file
+ Datastore class, implementing persistency on a JSON (or binary JSON) file
 */
 
 #ifndef DATASTORE_HPP
 #define DATASTORE_HPP
 
 #include <nlohmann/json.hpp>
+#include "histogram.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+/*!
+ * Persistent JSON store
+ *
+ * The store is kept in a JSON snapshot file, plus an append-only journal
+ * (the same path with a `.journal` suffix) where each save() appends one
+ * line with the JSON Patch (RFC 6902) operations since the previous save.
+ * Saving thus costs O(change) rather than O(size). When the journal grows
+ * larger than the snapshot (and than the compaction threshold), it is
+ * compacted: the snapshot is rewritten to a temporary file and atomically
+ * renamed over the old one, and the journal restarts empty.
+ * prepare() loads the snapshot and replays the journal on top of it.
+ *
+ * The first journal line holds a hash of the snapshot the journal applies
+ * to, so that after a crash in the middle of a compaction a stale journal
+ * is never replayed twice.
+ *
+ * Mutations made with set(), erase() and patch() are journaled directly, and
+ * get() reads values without affecting saves. Handing out a mutable
+ * reference with data() or operator[] instead takes a copy of the store, and
+ * the next save() finds the changes by diffing against it, which costs
+ * O(size) once per save; the copy is then dropped.
+ *
+ * By default, changes are written when save() is called. With set_async(),
+ * a background thread saves at most every `interval` ms, or as soon as
+ * `max_changes` changes are pending, so that many updates are merged into
+ * a single journal entry. In that mode, the references returned by data()
+ * and operator[] must only be used while holding lock(). flush() is a
+ * barrier, returning when all the changes made so far are on disk.
+ *
+ * The snapshot format is selected by the file extension: `.json`
+ * (default), `.msgpack` or `.cbor`; the binary formats are more compact and
+ * much faster to parse. The snapshot is read through a memory mapping. With
+ * set_lazy(), top-level values of a MessagePack snapshot are only indexed at
+ * load time, and parsed on first access. When a binary store does not exist
+ * yet but a `.json` one with the same name does, the latter is migrated and
+ * kept as `.json.bak`.
+ */
 class Datastore {
 public:
   Datastore() : _datastore_path("") {}
 
   ~Datastore() {
-    save();
+    set_async(false);
+    std::lock_guard<std::mutex> lock(_mtx);
+    save_locked();
+    compact_locked();
+    close_journal();
+    unmap_snapshot();
   }
 
+  Datastore(const Datastore &) = delete;
+  Datastore &operator=(const Datastore &) = delete;
+
   void prepare(std::string name) {
-    if (name.size() < 5 || name.substr(name.size() - 5) != ".json")
+    std::string ext = std::filesystem::path(name).extension().string();
+    if (ext != ".json" && ext != ".msgpack" && ext != ".cbor")
       name += ".json";
     if (_datastore_path.empty())
       _datastore_path = std::filesystem::temp_directory_path() / "mads" / name;
     if (!std::filesystem::exists(_datastore_path.parent_path())) {
       std::filesystem::create_directories(_datastore_path.parent_path());
     }
-    if (std::filesystem::exists(_datastore_path)) {
-      std::ifstream ifs(_datastore_path);
-      if (ifs.is_open()) {
-        try {
-          ifs >> _data;
-        } catch (...) {
-          _data = nlohmann::json{};
-        }
-        ifs.close();
-      }
-    } else {
-      _data = nlohmann::json{};
-    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    close_journal();
+    migrate();
+    replay_journal(load_snapshot());
+    _shadow = nlohmann::json{};
+    _shadow_ops = nlohmann::json::array();
+    _direct = false;
+    _pending = nlohmann::json::array();
+    _pending_sets.clear();
+    _changes = 0;
   }
 
   void prepare(std::string name, std::filesystem::path path) {
@@ -59,33 +121,666 @@ public:
     prepare(name, std::filesystem::path(path));
   }
 
+  /*!
+   * Mutable reference to a top-level value. The next save() diffs the whole
+   * store: use get() to read, and set() to write.
+   */
   nlohmann::json & operator[](const std::string &key) {
-    if (_data.contains(key))
+    materialize(key);
+    if (_data.contains(key)) {
+      direct();
+      changed();
       return _data[key];
-    else {
+    } else {
       static nlohmann::json j{};
       return j;
     }
   }
 
+  /*!
+   * Mutable reference to the whole store. As for operator[], the next save()
+   * diffs the whole store.
+   */
   nlohmann::json & data() {
+    materialize_all();
+    direct();
+    changed();
     return _data;
   }
-  
-  void save() const {
-    std::ofstream file(_datastore_path);
-    if (file.is_open()) {
-      file << _data.dump(2);
+
+  /*!
+   * Copy of a value, given a top-level key or a JSON pointer, or `def` if
+   * missing. Unlike operator[], it does not make the next save() diff the
+   * whole store.
+   */
+  nlohmann::json get(const std::string &key, const nlohmann::json &def = nullptr) {
+    nlohmann::json::json_pointer ptr = pointer(key);
+    std::lock_guard<std::mutex> lock(_mtx);
+    materialize_path(ptr.to_string());
+    return _data.contains(ptr) ? _data[ptr] : def;
+  }
+
+  bool contains(const std::string &key) {
+    nlohmann::json::json_pointer ptr = pointer(key);
+    std::lock_guard<std::mutex> lock(_mtx);
+    materialize_path(ptr.to_string());
+    return _data.contains(ptr);
+  }
+
+  /*!
+   * Sets a value. The key is a top-level key, or a JSON pointer if it starts
+   * with '/'; missing parent objects are created.
+   */
+  void set(const std::string &key, const nlohmann::json &value) {
+    nlohmann::json::json_pointer ptr = pointer(key);
+    std::lock_guard<std::mutex> lock(_mtx);
+    materialize_path(ptr.to_string());
+    // the journaled operation adds the topmost missing ancestor
+    nlohmann::json::json_pointer top = ptr;
+    while (!top.empty() && !top.parent_pointer().empty() && !_data.contains(top.parent_pointer()))
+      top = top.parent_pointer();
+    bool exists = _data.contains(top);
+    _data[ptr] = value;
+    std::string path = top.to_string();
+    // repeated sets of the same path are merged into the pending operation
+    auto it = _pending_sets.find(path);
+    if (it != _pending_sets.end()) {
+      _pending[it->second]["value"] = _data[top];
+    } else {
+      for (auto &[p, i] : _pending_sets) {
+        if (nested(p, path)) {
+          _pending_sets.clear();
+          break;
+        }
+      }
+      _pending_sets[path] = _pending.size();
+      _pending.push_back({{"op", exists ? "replace" : "add"}, {"path", path}, {"value", _data[top]}});
+    }
+    changed();
+  }
+
+  /*!
+   * Removes a value, given a top-level key or a JSON pointer
+   */
+  void erase(const std::string &key) {
+    nlohmann::json::json_pointer ptr = pointer(key);
+    std::lock_guard<std::mutex> lock(_mtx);
+    materialize_path(ptr.to_string());
+    if (ptr.empty() || !_data.contains(ptr)) return;
+    nlohmann::json ops = {{{"op", "remove"}, {"path", ptr.to_string()}}};
+    _data.patch_inplace(ops);
+    _pending.push_back(ops[0]);
+    _pending_sets.clear();
+    changed();
+  }
+
+  /*!
+   * Applies a JSON Patch (RFC 6902). Throws if the patch cannot be applied.
+   */
+  void patch(const nlohmann::json &ops) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    materialize_ops(ops);
+    _data.patch_inplace(ops);
+    for (auto &op : ops) _pending.push_back(op);
+    _pending_sets.clear();
+    changed();
+  }
+
+  /*!
+   * Appends the changes since the last save to the journal
+   */
+  void save() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    save_locked();
+  }
+
+  /*!
+   * Saves the pending changes and syncs the journal to disk
+   */
+  void flush() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    save_locked();
+    if (_journal) sync(_journal);
+  }
+
+  /*!
+   * Rewrites the snapshot with the current state and clears the journal.
+   * The snapshot is written to a temporary file and renamed.
+   */
+  void compact() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    compact_locked();
+  }
+
+  /*!
+   * Starts (or stops) saving in a background thread, at most every
+   * `interval`, or as soon as `max_changes` changes are pending
+   */
+  void set_async(bool async, std::chrono::milliseconds interval = std::chrono::milliseconds(1000),
+                 size_t max_changes = 1000) {
+    if (_flusher.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+      }
+      _cv.notify_one();
+      _flusher.join();
     }
+    _interval = interval;
+    _max_changes = std::max<size_t>(1, max_changes);
+    if (!async) return;
+    _stop = false;
+    _flusher = std::thread(&Datastore::flush_loop, this);
   }
 
+  /*!
+   * Lock to be held while using data() or operator[] in async mode
+   */
+  std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(_mtx); }
+
+  /*!
+   * Save statistics: number of saves and compactions, bytes written, and
+   * save latency (ms)
+   */
+  nlohmann::json stats() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return {
+      {"saves", _latency.count()},
+      {"compactions", _compactions},
+      {"bytes", _bytes},
+      {"journal_size", _journal_size},
+      {"latency_ms", _latency.summary()}
+    };
+  }
+
+  /*!
+   * Journal size beyond which the store is compacted (the snapshot size, if
+   * larger)
+   */
+  void set_compaction(size_t bytes) { _compaction = bytes; }
+
+  /*!
+   * If true, the top-level values of a MessagePack snapshot are parsed on
+   * first access. Call before prepare().
+   */
+  void set_lazy(bool lazy) { _lazy = lazy; }
+
+  /*!
+   * If true, the journal is synced to disk at each save (default false)
+   */
+  void set_sync(bool sync) { _sync = sync; }
+
   std::string path() const {
     return _datastore_path.string();
   }
+
+  std::filesystem::path journal_path() const {
+    std::filesystem::path p = _datastore_path;
+    p += ".journal";
+    return p;
+  }
+
+  size_t journal_size() const { return _journal_size; }
+
+  // Snapshot format, from the file extension: json, msgpack or cbor
+  std::string format() const {
+    std::string ext = _datastore_path.extension().string();
+    return ext == ".msgpack" || ext == ".cbor" ? ext.substr(1) : "json";
+  }
+
+  // Number of top-level values not yet parsed
+  size_t lazy_count() const { return _lazy_keys.size(); }
   
 private:
+  // Counts a change, waking up the background thread when enough are pending
+  void changed() {
+    if (++_changes == 1 || _changes >= _max_changes) _cv.notify_one();
+  }
+
+  void flush_loop() {
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (!_stop) {
+      if (_changes == 0) {
+        _cv.wait(lock, [this] { return _stop || _changes > 0; });
+      } else {
+        _cv.wait_until(lock, _last_save + _interval,
+                       [this] { return _stop || _changes >= _max_changes; });
+      }
+      if (_stop) break;
+      if (_changes >= _max_changes || std::chrono::steady_clock::now() >= _last_save + _interval)
+        save_locked();
+    }
+  }
+
+  // Call with _mtx locked
+  void save_locked() {
+    _changes = 0;
+    _last_save = std::chrono::steady_clock::now();
+    if (_datastore_path.empty()) return;
+    nlohmann::json ops = std::move(_pending);
+    _pending = nlohmann::json::array();
+    _pending_sets.clear();
+    if (_direct) {
+      // changes made through references: the operations pending when the
+      // first reference was handed out, then the diff against the copy taken
+      // at that time (which covers the operations journaled since)
+      ops = std::move(_shadow_ops);
+      for (auto &op : nlohmann::json::diff(_shadow, _data)) ops.push_back(std::move(op));
+      _shadow = nlohmann::json{};
+      _shadow_ops = nlohmann::json::array();
+      _direct = false;
+    }
+    if (ops.empty()) return;
+    if (!_journal && !open_journal()) return;
+    std::string line = ops.dump() + "\n";
+    fwrite(line.data(), 1, line.size(), _journal);
+    fflush(_journal);
+    if (_sync) sync(_journal);
+    _journal_size += line.size();
+    _bytes += line.size();
+    if (_journal_size > std::max(_compaction, _snapshot_size)) compact_locked();
+    _latency.add(std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - _last_save).count());
+  }
+
+  // Call with _mtx locked
+  void compact_locked() {
+    if (_datastore_path.empty()) return;
+    bool changed = _direct || !_pending.empty();
+    if (!changed && _journal_size == 0 && std::filesystem::exists(_datastore_path)) return;
+    materialize_all();
+    if (changed) {
+      _shadow = nlohmann::json{};
+      _shadow_ops = nlohmann::json::array();
+      _pending = nlohmann::json::array();
+      _pending_sets.clear();
+      _direct = false;
+      _changes = 0;
+    }
+    unmap_snapshot();
+    std::string snapshot = serialize(_data);
+    if (!replace_file(_datastore_path, snapshot)) return;
+    _snapshot_size = snapshot.size();
+    _bytes += snapshot.size();
+    _compactions++;
+    // a fresh journal for the new snapshot, replacing the old one atomically
+    close_journal();
+    if (!replace_file(journal_path(), header(hash(snapshot.data(), snapshot.size())))) return;
+    _journal_size = 0;
+    open_journal();
+  }
+
+  static nlohmann::json::json_pointer pointer(const std::string &key) {
+    if (!key.empty() && key[0] == '/') return nlohmann::json::json_pointer(key);
+    nlohmann::json::json_pointer ptr;
+    ptr.push_back(key);
+    return ptr;
+  }
+
+  // True if one pointer is a prefix of the other
+  static bool nested(const std::string &a, const std::string &b) {
+    const std::string &s = a.size() < b.size() ? a : b, &l = a.size() < b.size() ? b : a;
+    return l.compare(0, s.size(), s) == 0 && (l.size() == s.size() || l[s.size()] == '/');
+  }
+
+  // FNV-1a hash of the snapshot, identifying it in the journal header
+  static std::string hash(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+    return buf;
+  }
+
+  static std::string header(const std::string &snapshot_hash) {
+    return nlohmann::json{{"snapshot", snapshot_hash}}.dump() + "\n";
+  }
+
+  // Applies the journal, if it refers to the loaded snapshot
+  void replay_journal(const std::string &snapshot_hash) {
+    _journal_size = 0;
+    std::ifstream ifs(journal_path(), std::ios::binary);
+    std::string line;
+    bool valid = false;
+    if (ifs.is_open() && std::getline(ifs, line)) {
+      nlohmann::json h = nlohmann::json::parse(line, nullptr, false);
+      valid = h.is_object() && h.value("snapshot", "") == snapshot_hash;
+    }
+    size_t header_size = line.size() + 1;
+    if (valid) {
+      while (std::getline(ifs, line)) {
+        nlohmann::json ops = nlohmann::json::parse(line, nullptr, false);
+        if (ops.is_discarded() || !ops.is_array()) break; // truncated by a crash
+        materialize_ops(ops);
+        try {
+          _data.patch_inplace(ops);
+        } catch (nlohmann::json::exception &e) {
+          std::cerr << "Datastore: skipping journal entry: " << e.what() << std::endl;
+        }
+        _journal_size += line.size() + 1;
+      }
+    }
+    ifs.close();
+    if (valid) {
+      // drop a truncated tail, so that new entries start on a new line
+      std::filesystem::resize_file(journal_path(), header_size + _journal_size);
+    } else {
+      // no journal, or a stale one: start a new one for this snapshot
+      replace_file(journal_path(), header(snapshot_hash));
+    }
+  }
+
+  std::string serialize(const nlohmann::json &j) const {
+    std::vector<uint8_t> bin;
+    std::string fmt = format();
+    if (fmt == "msgpack") nlohmann::json::to_msgpack(j, bin);
+    else if (fmt == "cbor") nlohmann::json::to_cbor(j, bin);
+    else return j.dump(2);
+    return std::string(bin.begin(), bin.end());
+  }
+
+  // Parses the snapshot, or indexes its top-level values if lazy; returns
+  // its hash
+  std::string load_snapshot() {
+    _data = nlohmann::json{};
+    _lazy_keys.clear();
+    unmap_snapshot();
+    if (!map_snapshot()) {
+      _snapshot_size = 0;
+      return hash(nullptr, 0);
+    }
+    const uint8_t *begin = _map, *end = _map + _map_size;
+    std::string fmt = format();
+    if (fmt == "msgpack" && _lazy && index_msgpack()) {
+      _data = nlohmann::json::object();
+    } else if (fmt == "msgpack") {
+      _data = nlohmann::json::from_msgpack(begin, end, true, false);
+    } else if (fmt == "cbor") {
+      _data = nlohmann::json::from_cbor(begin, end, true, false);
+    } else {
+      _data = nlohmann::json::parse(begin, end, nullptr, false);
+    }
+    if (_data.is_discarded()) {
+      std::cerr << "Datastore: cannot parse " << _datastore_path << std::endl;
+      _data = nlohmann::json{};
+    }
+    _snapshot_size = _map_size;
+    std::string h = hash(_map, _map_size);
+    if (_lazy_keys.empty()) unmap_snapshot();
+    return h;
+  }
+
+  // Converts a JSON store with the same name to the binary format
+  void migrate() {
+    if (format() == "json" || std::filesystem::exists(_datastore_path)) return;
+    std::filesystem::path binary = _datastore_path, text = _datastore_path;
+    text.replace_extension(".json");
+    if (!std::filesystem::exists(text)) return;
+    _datastore_path = text;
+    replay_journal(load_snapshot());
+    std::filesystem::path old_journal = journal_path();
+    _datastore_path = binary;
+    compact_locked();
+    close_journal();
+    std::filesystem::path backup = text;
+    backup += ".bak";
+    std::filesystem::rename(text, backup);
+    std::filesystem::remove(old_journal);
+    std::cerr << "Datastore: migrated " << text << " to " << binary << std::endl;
+  }
+
+  // Maps the snapshot read-only (on Windows, it is read into memory)
+  bool map_snapshot() {
+#ifdef _WIN32
+    std::ifstream ifs(_datastore_path, std::ios::binary);
+    if (!ifs.is_open()) return false;
+    _map_buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    _map = reinterpret_cast<const uint8_t *>(_map_buffer.data());
+    _map_size = _map_buffer.size();
+#else
+    int fd = ::open(_datastore_path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        _map = static_cast<const uint8_t *>(p);
+        _map_size = st.st_size;
+      }
+    }
+    ::close(fd);
+#endif
+    if (_map_size == 0) unmap_snapshot();
+    return _map != nullptr;
+  }
+
+  void unmap_snapshot() {
+#ifdef _WIN32
+    _map_buffer.clear();
+    _map_buffer.shrink_to_fit();
+#else
+    if (_map) ::munmap(const_cast<uint8_t *>(_map), _map_size);
+#endif
+    _map = nullptr;
+    _map_size = 0;
+  }
+
+  // Takes the copy the next save diffs against, when the first mutable
+  // reference since the last save is handed out
+  void direct() {
+    if (_direct) return;
+    _shadow = _data;
+    _shadow_ops = std::move(_pending);
+    _pending = nlohmann::json::array();
+    _pending_sets.clear();
+    _direct = true;
+  }
+
+  // Parses a lazily loaded top-level value
+  void materialize(const std::string &key) {
+    auto it = _lazy_keys.find(key);
+    if (it == _lazy_keys.end()) return;
+    nlohmann::json v = nlohmann::json::from_msgpack(_map + it->second.first,
+                                                    _map + it->second.second, true, false);
+    if (v.is_discarded()) v = nlohmann::json{};
+    if (_direct) _shadow[key] = v;
+    _data[key] = std::move(v);
+    _lazy_keys.erase(it);
+    if (_lazy_keys.empty()) unmap_snapshot();
+  }
+
+  void materialize_all() {
+    while (!_lazy_keys.empty()) materialize(_lazy_keys.begin()->first);
+  }
+
+  // Parses the top-level value a JSON pointer refers to
+  void materialize_path(const std::string &path) {
+    if (_lazy_keys.empty()) return;
+    if (path.empty()) return materialize_all();
+    std::string key = path.substr(1, path.find('/', 1) - 1);
+    for (size_t i = 0; (i = key.find('~', i)) != std::string::npos; i++)
+      key.replace(i, 2, key.compare(i, 2, "~1") == 0 ? "/" : "~");
+    materialize(key);
+  }
+
+  void materialize_ops(const nlohmann::json &ops) {
+    if (_lazy_keys.empty()) return;
+    if (!ops.is_array()) return materialize_all();
+    for (auto &op : ops) {
+      if (!op.is_object()) continue;
+      if (op.contains("path") && op["path"].is_string()) materialize_path(op["path"]);
+      if (op.contains("from") && op["from"].is_string()) materialize_path(op["from"]);
+    }
+  }
+
+  // Builds the index of top-level values of a MessagePack map. Returns false
+  // if the snapshot is not a map with string keys.
+  bool index_msgpack() {
+    const uint8_t *p = _map;
+    size_t size = _map_size, pos = 1, count;
+    if ((p[0] & 0xf0) == 0x80) count = p[0] & 0x0f;
+    else if (p[0] == 0xde && size >= 3) count = big_endian(p + 1, 2), pos = 3;
+    else if (p[0] == 0xdf && size >= 5) count = big_endian(p + 1, 4), pos = 5;
+    else return false;
+    for (size_t i = 0; i < count; i++) {
+      if (pos >= size) return false;
+      uint8_t t = p[pos++];
+      size_t len;
+      if ((t & 0xe0) == 0xa0) len = t & 0x1f;
+      else if (t >= 0xd9 && t <= 0xdb) {
+        size_t n = size_t(1) << (t - 0xd9);
+        if (pos + n > size) return false;
+        len = big_endian(p + pos, n);
+        pos += n;
+      }
+      else return false;
+      if (pos + len > size) return false;
+      std::string key(reinterpret_cast<const char *>(p + pos), len);
+      pos += len;
+      size_t start = pos;
+      if (!msgpack_skip(p, size, pos)) return false;
+      _lazy_keys[key] = {start, pos};
+    }
+    if (pos != size) {
+      _lazy_keys.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // Moves pos past one MessagePack value, without parsing it
+  static bool msgpack_skip(const uint8_t *p, size_t size, size_t &pos) {
+    size_t items = 1;
+    while (items > 0) {
+      if (pos >= size) return false;
+      uint8_t t = p[pos++];
+      items--;
+      size_t skip = 0, children = 0, n = 0;
+      if (t <= 0x7f || t >= 0xe0 || t == 0xc0 || t == 0xc2 || t == 0xc3) {
+        // fixint, nil, bool
+      } else if (t <= 0x8f) {
+        children = 2 * (t & 0x0f);
+      } else if (t <= 0x9f) {
+        children = t & 0x0f;
+      } else if (t <= 0xbf) {
+        skip = t & 0x1f;
+      } else {
+        switch (t) {
+        case 0xc4: case 0xd9: n = 1; break;          // bin8, str8
+        case 0xc5: case 0xda: n = 2; break;          // bin16, str16
+        case 0xc6: case 0xdb: n = 4; break;          // bin32, str32
+        case 0xc7: n = 1; skip = 1; break;           // ext8
+        case 0xc8: n = 2; skip = 1; break;           // ext16
+        case 0xc9: n = 4; skip = 1; break;           // ext32
+        case 0xcc: case 0xd0: skip = 1; break;
+        case 0xcd: case 0xd1: skip = 2; break;
+        case 0xca: case 0xce: case 0xd2: skip = 4; break;
+        case 0xcb: case 0xcf: case 0xd3: skip = 8; break;
+        case 0xd4: skip = 2; break;                  // fixext
+        case 0xd5: skip = 3; break;
+        case 0xd6: skip = 5; break;
+        case 0xd7: skip = 9; break;
+        case 0xd8: skip = 17; break;
+        case 0xdc: case 0xdd: case 0xde: case 0xdf: { // array16/32, map16/32
+          size_t w = (t & 1) ? 4 : 2;
+          if (pos + w > size) return false;
+          children = big_endian(p + pos, w) * (t >= 0xde ? 2 : 1);
+          pos += w;
+          break;
+        }
+        default: return false;
+        }
+        if (n) {
+          if (pos + n > size) return false;
+          skip += big_endian(p + pos, n);
+          pos += n;
+        }
+      }
+      if (skip > size - pos || children > size - pos) return false;
+      pos += skip;
+      items += children;
+    }
+    return true;
+  }
+
+  static size_t big_endian(const uint8_t *p, size_t n) {
+    size_t v = 0;
+    for (size_t i = 0; i < n; i++) v = (v << 8) | p[i];
+    return v;
+  }
+
+  bool open_journal() {
+    _journal = fopen(journal_path().string().c_str(), "ab");
+    return _journal != nullptr;
+  }
+
+  void close_journal() {
+    if (_journal) fclose(_journal);
+    _journal = nullptr;
+  }
+
+  static bool write_file(const std::filesystem::path &path, const std::string &content) {
+    FILE *f = fopen(path.string().c_str(), "wb");
+    if (!f) return false;
+    bool ok = fwrite(content.data(), 1, content.size(), f) == content.size();
+    fflush(f);
+    sync(f);
+    fclose(f);
+    return ok;
+  }
+
+  // Writes a temporary file and renames it over `path`, so that a crash
+  // leaves either the old content or the new one
+  static bool replace_file(const std::filesystem::path &path, const std::string &content) {
+    std::filesystem::path tmp = path;
+    tmp += ".tmp";
+    if (!write_file(tmp, content)) return false;
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    return !ec;
+  }
+
+  static void sync(FILE *f) {
+#ifdef _WIN32
+    _commit(_fileno(f));
+#else
+    fsync(fileno(f));
+#endif
+  }
+
   std::filesystem::path _datastore_path;
   nlohmann::json _data;
+  nlohmann::json _shadow;   // copy taken when references were handed out
+  nlohmann::json _shadow_ops = nlohmann::json::array(); // pending at that time
+  nlohmann::json _pending = nlohmann::json::array();
+  std::unordered_map<std::string, size_t> _pending_sets; // path -> index in _pending
+  bool _direct = false;     // references to _data were handed out
+  FILE *_journal = nullptr;
+  size_t _journal_size = 0;  // entries, excluding the header
+  size_t _snapshot_size = 0;
+  size_t _compaction = 1 << 20;
+  bool _sync = false;
+  bool _lazy = false;
+  const uint8_t *_map = nullptr;  // snapshot mapping, kept while values are lazy
+  size_t _map_size = 0;
+#ifdef _WIN32
+  std::string _map_buffer;
+#endif
+  std::map<std::string, std::pair<size_t, size_t>> _lazy_keys; // key -> value range
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::thread _flusher;
+  bool _stop = false;
+  size_t _changes = 0;      // since the last save
+  size_t _max_changes = 1000;
+  std::chrono::milliseconds _interval{1000};
+  std::chrono::steady_clock::time_point _last_save = std::chrono::steady_clock::now();
+  Histogram _latency{1e-3, 1e5}; // ms
+  size_t _bytes = 0, _compactions = 0;
 };
 
-#endif // DATASTORE_HPP
\ No newline at end of file
+#endif // DATASTORE_HPP
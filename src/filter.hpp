@@ -14,9 +14,11 @@ Base class for filter plugins
 #include <string>
 #include <vector>
 #include <map>
+#include <type_traits>
 #include <nlohmann/json.hpp>
 #include <chrono>
 #include "common.hpp"
+#include "timestamps.hpp"
 
 #ifdef _WIN32
 #define EXPORTIT __declspec(dllexport)
@@ -45,7 +47,7 @@ template <typename Tin = std::vector<double>,
           typename Tout = std::vector<double>>
 class Filter {
 public:
-  Filter() : dummy(false), _error("No error")  {}
+  Filter() : dummy(false), next_loop_duration(0), _error("No error")  {}
   virtual ~Filter() {}
 
   /*!
@@ -94,8 +96,44 @@ public:
    */
   virtual void set_params(const nlohmann::json &params){
     _agent_id = params.value("agent_id", "");
+    _timestamps = params.value("timestamps", false);
   };
 
+  /*!
+   * Stamps the arrival time of the input data
+   *
+   * When the `timestamps` parameter is true, this adds to the input, in
+   * place, a new hop in its `timestamps` array, holding the arrival time;
+   * otherwise, the input is not touched (and not copied). Agents call it
+   * right before load_data().
+   *
+   * @param in The input data
+   */
+  void stamp_arrival(Tin &in) {
+    if constexpr (std::is_same_v<Tin, nlohmann::json>) {
+      if (_timestamps && in.is_object()) Timestamps::arrive(in, kind());
+    }
+  }
+
+  /*!
+   * Stamps the departure time of the output data
+   *
+   * The timestamps of the last input are copied into the output, if the
+   * filter did not, and the departure time of this stage is set. Agents call
+   * it right after process().
+   *
+   * @param in The (stamped) input data
+   * @param out The output data
+   */
+  void stamp(Tin const &in, Tout &out) {
+    if constexpr (std::is_same_v<Tin, nlohmann::json> && std::is_same_v<Tout, nlohmann::json>) {
+      if (!_timestamps || !out.is_object()) return;
+      if (!out.contains("timestamps") && in.is_object() && in.contains("timestamps"))
+        out["timestamps"] = in["timestamps"];
+      Timestamps::depart(out, kind());
+    }
+  }
+
   /*!
    * Returns the filter information
    *
@@ -106,6 +144,35 @@ public:
    */
   virtual std::map<std::string, std::string> info() = 0;
 
+  /*!
+   * Saves the filter state
+   *
+   * Stateful filters override this and load_state(), so that agents can
+   * checkpoint them (see Checkpointer in checkpoint.hpp) and restart without
+   * losing their state. The format is up to the filter.
+   * The default implementation reports that checkpoints are not supported.
+   *
+   * @param state The serialized state
+   * @return return_type::success if the state was saved
+   */
+  virtual return_type save_state(std::vector<unsigned char> &state) {
+    _error = "State checkpoints not supported by " + kind();
+    return return_type::error;
+  }
+
+  /*!
+   * Restores a state saved by save_state()
+   *
+   * It is called after set_params().
+   *
+   * @param state The serialized state
+   * @return return_type::success if the state was restored
+   */
+  virtual return_type load_state(std::vector<unsigned char> const &state) {
+    _error = "State checkpoints not supported by " + kind();
+    return return_type::error;
+  }
+
   /*!
    * Returns the error message
    *
@@ -139,6 +206,7 @@ protected:
   std::string _error;
   std::string _agent_id;
   nlohmann::json _params;
+  bool _timestamps = false;
 };
 
 #ifndef HAVE_MAIN
@@ -152,6 +220,9 @@ public:
   FilterDriver(std::string name, int version)
       : pugg::Driver(Filter<Tin, Tout>::server_name(), name, version) {}
   virtual Filter<Tin, Tout> *create() = 0;
+  // Features known without creating an instance: "checkpoint" if the filter
+  // overrides save_state() (set by INSTALL_FILTER_DRIVER)
+  virtual std::vector<std::string> capabilities() { return {}; }
 };
 // @endcond
 
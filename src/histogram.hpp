@@ -0,0 +1,142 @@
+/*
+  _   _ _     _
+ | | | (_)___| |_ ___   __ _ _ __ __ _ _ __ ___
+ | |_| | / __| __/ _ \ / _` | '__/ _` | '_ ` _ \
+ |  _  | \__ \ || (_) | (_| | | | (_| | | | | | |
+ |_| |_|_|___/\__\___/ \__, |_|  \__,_|_| |_| |_|
+                       |___/
+ Histogram class, with log-spaced bins, for latency and jitter statistics
+*/
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/*!
+ * Histogram with logarithmically spaced bins
+ *
+ * Values are binned with a constant relative resolution between `min` and
+ * `max` (`bins_per_decade` bins for each power of ten), plus one underflow
+ * and one overflow bin. Memory and insertion time are constant, so it is
+ * suitable for collecting latencies on hot paths.
+ * Percentiles are estimated as the geometric center of the bin.
+ */
+class Histogram {
+public:
+  Histogram(double min = 1, double max = 1e7, unsigned bins_per_decade = 10)
+      : _min(min), _max(max), _bpd(bins_per_decade) {
+    _bins.resize(static_cast<size_t>(std::ceil(std::log10(_max / _min) * _bpd)) + 2, 0);
+    reset();
+  }
+
+  /*!
+   * Adds a value to the histogram
+   */
+  void add(double v) {
+    _count++;
+    _sum += v;
+    _vmin = std::min(_vmin, v);
+    _vmax = std::max(_vmax, v);
+    _bins[bin(v)]++;
+  }
+
+  /*!
+   * Clears all the collected values
+   */
+  void reset() {
+    std::fill(_bins.begin(), _bins.end(), 0);
+    _count = 0;
+    _sum = 0;
+    _vmin = std::numeric_limits<double>::infinity();
+    _vmax = -std::numeric_limits<double>::infinity();
+  }
+
+  /*!
+   * Adds the values collected by another histogram with the same layout
+   */
+  Histogram &operator+=(const Histogram &other) {
+    if (other._bins.size() != _bins.size()) return *this;
+    for (size_t i = 0; i < _bins.size(); i++) _bins[i] += other._bins[i];
+    _count += other._count;
+    _sum += other._sum;
+    _vmin = std::min(_vmin, other._vmin);
+    _vmax = std::max(_vmax, other._vmax);
+    return *this;
+  }
+
+  size_t count() const { return _count; }
+  double mean() const { return _count ? _sum / _count : 0; }
+  double min() const { return _count ? _vmin : 0; }
+  double max() const { return _count ? _vmax : 0; }
+
+  /*!
+   * Estimates the p-th percentile, with p in [0, 100]
+   */
+  double percentile(double p) const {
+    if (_count == 0) return 0;
+    size_t target = static_cast<size_t>(std::ceil(p / 100.0 * _count));
+    target = std::max<size_t>(1, target);
+    size_t acc = 0;
+    for (size_t i = 0; i < _bins.size(); i++) {
+      acc += _bins[i];
+      if (acc >= target) {
+        if (i == 0) return _vmin;
+        if (i == _bins.size() - 1) return _vmax;
+        double v = _min * std::pow(10.0, (i - 0.5) / _bpd);
+        return std::clamp(v, _vmin, _vmax);
+      }
+    }
+    return _vmax;
+  }
+
+  /*!
+   * Returns a summary as a JSON object with count, mean, min, max and the
+   * 50th, 90th, 99th and 99.9th percentiles
+   */
+  nlohmann::json summary() const {
+    return {
+      {"count", _count},
+      {"mean", mean()},
+      {"min", min()},
+      {"max", max()},
+      {"p50", percentile(50)},
+      {"p90", percentile(90)},
+      {"p99", percentile(99)},
+      {"p999", percentile(99.9)}
+    };
+  }
+
+  /*!
+   * Returns the non-empty bins as an array of [upper bound, count] pairs
+   */
+  nlohmann::json bins() const {
+    nlohmann::json j = nlohmann::json::array();
+    for (size_t i = 0; i < _bins.size(); i++) {
+      if (_bins[i] == 0) continue;
+      double upper = i == _bins.size() - 1 ? _vmax : _min * std::pow(10.0, double(i) / _bpd);
+      j.push_back({upper, _bins[i]});
+    }
+    return j;
+  }
+
+private:
+  size_t bin(double v) const {
+    if (!(v >= _min)) return 0;
+    if (v >= _max) return _bins.size() - 1;
+    size_t i = static_cast<size_t>(std::log10(v / _min) * _bpd) + 1;
+    return std::min(i, _bins.size() - 2);
+  }
+
+  double _min, _max;
+  unsigned _bpd;
+  std::vector<size_t> _bins;
+  size_t _count;
+  double _sum, _vmin, _vmax;
+};
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,259 @@
+/*
+  _   _       _     ____      _                 _
+ | | | | ___ | |_  |  _ \ ___| | ___   __ _  __| |
+ | |_| |/ _ \| __| | |_) / _ \ |/ _ \ / _` |/ _` |
+ |  _  | (_) | |_  |  _ <  __/ | (_) | (_| | (_| |
+ |_| |_|\___/ \__| |_| \_\___|_|\___/ \__,_|\__,_|
+
+ HotReload class, replacing a running filter when its plugin file changes
+*/
+
+#ifndef HOT_RELOAD_HPP
+#define HOT_RELOAD_HPP
+
+#include "filter.hpp"
+#include "histogram.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*!
+ * Hot reload of a filter plugin
+ *
+ * A background thread watches the modification time and size of the
+ * `.plugin` file. Once they have been stable for one polling interval (so
+ * that a file being copied is not loaded half-written), the file is copied
+ * to a unique temporary path (the dynamic loader would otherwise return the
+ * library already loaded) and loaded in a new pugg::Kernel. The driver must
+ * have the same protocol version as the host; a new instance is created and
+ * configured with the same parameters, all off the message path.
+ *
+ * The host calls update() between messages. If a new instance is ready, the
+ * old one is drained (with an optional callback), its state is moved to the
+ * new one through Filter::save_state()/load_state() when supported, and the
+ * instances are swapped. Only this part pauses the message flow, and its
+ * duration is measured. The old instance is then deleted and its plugin
+ * unloaded.
+ *
+ * The class owns the current instance, starting with the one given to the
+ * constructor.
+ */
+template <typename Tin = nlohmann::json, typename Tout = nlohmann::json>
+class HotReload {
+  using FilterT = Filter<Tin, Tout>;
+  using DriverT = FilterDriver<Tin, Tout>;
+  using clock = std::chrono::steady_clock;
+
+  struct Loaded {
+    std::unique_ptr<pugg::Kernel> kernel;
+    std::filesystem::path file; // temporary copy
+    FilterT *instance = nullptr;
+  };
+
+public:
+  HotReload(std::filesystem::path plugin, std::string driver, nlohmann::json params,
+            FilterT *current, std::chrono::milliseconds interval = std::chrono::milliseconds(500))
+      : _plugin(plugin), _driver(driver), _params(params), _current(current), _interval(interval) {
+    _watcher = std::thread(&HotReload::watch_loop, this);
+  }
+
+  ~HotReload() {
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      _stop = true;
+    }
+    _cv.notify_one();
+    _watcher.join();
+    unload(_candidate);
+    delete _current;
+    unload(_loaded);
+  }
+
+  HotReload(const HotReload &) = delete;
+  HotReload &operator=(const HotReload &) = delete;
+
+  /*!
+   * The current filter instance. It may change at each update().
+   */
+  FilterT *filter() const { return _current; }
+
+  /*!
+   * Swaps in the new version of the filter, if one is ready. Call it between
+   * messages. `drain` is called on the old instance before its state is
+   * saved, e.g. to collect pending outputs. Returns true if swapped.
+   */
+  bool update(std::function<void(FilterT *)> drain = nullptr) {
+    std::unique_ptr<Loaded> next;
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      if (!_candidate) return false;
+      next = std::move(_candidate);
+    }
+    auto start = clock::now();
+    if (drain) drain(_current);
+    std::vector<unsigned char> state;
+    bool transferred = _current->save_state(state) == return_type::success &&
+                       next->instance->load_state(state) == return_type::success;
+    FilterT *old = _current;
+    _current = next->instance;
+    next->instance = nullptr; // now owned as _current
+    std::swap(_loaded, next);
+    double pause = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      _transferred = transferred;
+      _pause = pause;
+      _pauses.add(pause);
+      _reloads++;
+    }
+    // the previous version is released after the swap
+    delete old;
+    unload(next);
+    return true;
+  }
+
+  /*!
+   * Reload statistics: reloads, failures, last error, whether the state was
+   * transferred at the last reload, and switchover pauses (ms)
+   */
+  nlohmann::json stats() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return {
+      {"reloads", _reloads},
+      {"failures", _failures},
+      {"error", _error},
+      {"state_transferred", _transferred},
+      {"last_pause_ms", _pause},
+      {"pause_ms", _pauses.summary()}
+    };
+  }
+
+  /*!
+   * Last reload error, empty if none
+   */
+  std::string error() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _error;
+  }
+
+private:
+  struct Stamp {
+    std::filesystem::file_time_type mtime;
+    uintmax_t size = 0;
+    bool operator!=(const Stamp &o) const { return mtime != o.mtime || size != o.size; }
+  };
+
+  Stamp stamp() const {
+    std::error_code ec;
+    Stamp s;
+    s.mtime = std::filesystem::last_write_time(_plugin, ec);
+    s.size = std::filesystem::file_size(_plugin, ec);
+    return s;
+  }
+
+  void watch_loop() {
+    Stamp last = stamp();
+    bool changed = false;
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (!_stop) {
+      _cv.wait_for(lock, _interval, [this] { return _stop; });
+      if (_stop) break;
+      Stamp now = stamp();
+      if (now != last) {
+        // wait until the file is stable
+        last = now;
+        changed = true;
+        continue;
+      }
+      if (!changed || now.size == 0) continue;
+      changed = false;
+      lock.unlock();
+      std::string error;
+      std::unique_ptr<Loaded> loaded = load(error);
+      lock.lock();
+      if (!loaded) {
+        _error = error;
+        _failures++;
+        continue;
+      }
+      _error.clear();
+      unload(_candidate); // superseded before being swapped in
+      _candidate = std::move(loaded);
+    }
+  }
+
+  // Loads the plugin in a new kernel and creates a configured instance
+  std::unique_ptr<Loaded> load(std::string &error) {
+    auto loaded = std::make_unique<Loaded>();
+    auto dir = std::filesystem::temp_directory_path() / "mads-hot-reload";
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    loaded->file = dir / (_plugin.stem().string() + "-" + std::to_string(clock::now().time_since_epoch().count()) +
+                          _plugin.extension().string());
+    std::filesystem::copy_file(_plugin, loaded->file, std::filesystem::copy_options::overwrite_existing, ec);
+    if (ec) {
+      error = "Cannot copy " + _plugin.string() + ": " + ec.message();
+      return nullptr;
+    }
+    loaded->kernel = std::make_unique<pugg::Kernel>();
+    loaded->kernel->add_server(FilterT::server_name(), FilterT::version);
+    if (!loaded->kernel->load_plugin(loaded->file.string())) {
+      error = "Cannot load " + _plugin.string();
+      unload(loaded);
+      return nullptr;
+    }
+    // drivers with an older protocol version are rejected by the kernel
+    DriverT *driver = nullptr;
+    auto drivers = loaded->kernel->template get_all_drivers<DriverT>(FilterT::server_name());
+    for (auto d : drivers) {
+      if ((_driver.empty() && drivers.size() == 1) || d->name() == _driver) driver = d;
+    }
+    if (!driver || driver->version() != FilterT::version) {
+      error = "No driver " + _driver + " with protocol version " +
+              std::to_string(FilterT::version) + " in " + _plugin.string();
+      unload(loaded);
+      return nullptr;
+    }
+    loaded->instance = driver->create();
+    loaded->instance->set_params(_params);
+    return loaded;
+  }
+
+  static void unload(std::unique_ptr<Loaded> &loaded) {
+    if (!loaded) return;
+    delete loaded->instance;
+    if (loaded->kernel) loaded->kernel->clear_drivers();
+    loaded->kernel.reset();
+    std::error_code ec;
+    std::filesystem::remove(loaded->file, ec);
+    loaded.reset();
+  }
+
+  std::filesystem::path _plugin;
+  std::string _driver;
+  nlohmann::json _params;
+  FilterT *_current;
+  std::unique_ptr<Loaded> _loaded;    // plugin of the current instance, if reloaded
+  std::unique_ptr<Loaded> _candidate; // ready to be swapped in
+  std::chrono::milliseconds _interval;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::thread _watcher;
+  bool _stop = false;
+  std::string _error;
+  size_t _reloads = 0, _failures = 0;
+  bool _transferred = false;
+  double _pause = 0;
+  Histogram _pauses{1e-3, 1e5}; // ms
+};
+
+#endif // HOT_RELOAD_HPP
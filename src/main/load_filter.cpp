@@ -1,10 +1,20 @@
 #include "../filter.hpp"
+#include "../checkpoint.hpp"
+#include "../hot_reload.hpp"
+#include "../ticker.hpp"
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
 #include <thread>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <filesystem>
+#include <chrono>
+#include "../plugin_index.hpp"
+#ifdef MADS_STATIC_PLUGINS
+#include "../registry.hpp"
+#endif
 
 using namespace std;
 
@@ -13,6 +23,7 @@ using FilterJ = Filter<json, json>;
 using FilterDriverJ = FilterDriver<json, json>;
 
 int main(int argc, char *argv[]) {
+  auto startup = chrono::steady_clock::now();
   pugg::Kernel kernel;
   string json_file = "";
   // add a generic server to the kernel to initilize it
@@ -27,9 +38,53 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  // with a directory, the plugin providing the named driver is found through
+  // a cached index, and only that one is loaded: the arguments become
+  // <plugin> [json], or <plugin> <name> [json] if it has more drivers
+  vector<char *> args(argv, argv + argc);
+  string plugin_path;
+  if (filesystem::is_directory(argv[1])) {
+    if (argc < 3) {
+      cout << "Usage: " << argv[0] << " <plugin dir> <name> [json]" << endl;
+      return 1;
+    }
+    PluginIndex index(argv[1]);
+    if (!index.scan()) {
+      cout << index.error() << endl;
+      return 1;
+    }
+    cout << "Plugin index: " << index.stats() << endl;
+    plugin_path = index.find(FilterJ::server_name(), argv[2]).string();
+    if (plugin_path.empty()) {
+      cout << "No driver " << argv[2] << " in " << argv[1] << ", available:" << endl;
+      for (auto &d : index.drivers(FilterJ::server_name()))
+        cout << " - " << d["name"].get<string>() << " (" << d["file"].get<string>() << ")" << endl;
+      return 1;
+    }
+    args[1] = plugin_path.data();
+    size_t n = 0;
+    string file = filesystem::path(plugin_path).filename().string();
+    for (auto &d : index.drivers(FilterJ::server_name())) n += d["file"] == file;
+    if (n == 1) args.erase(args.begin() + 2);
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+  }
+
   cout << "Loading plugin... ";
   cout.flush();
   // load the plugin
+#ifdef MADS_STATIC_PLUGINS
+  // plugins built into the executable are selected by name (a path to a
+  // missing file also selects the built-in plugin with the same name)
+  if (!filesystem::exists(argv[1])) {
+    string name = filesystem::path(argv[1]).stem().string();
+    if (Registry::install(kernel, FilterJ::server_name(), name) == 0) {
+      cout << "\nNo plugin " << argv[1] << ", built-in plugins:" << endl;
+      for (auto &n : Registry::names(FilterJ::server_name())) cout << " - " << n << endl;
+      return 1;
+    }
+  } else
+#endif
   kernel.load_plugin(argv[1]);
 
   // find the proper driver in the plugin
@@ -64,6 +119,9 @@ int main(int argc, char *argv[]) {
   FilterJ *filter = driver->create();
   // Now we can create an instance of class FilterJ from the driver
   cout << "\nLoaded plugin: " << filter->kind() << endl;
+  cout << "Startup time: "
+       << chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count()
+       << " ms" << endl;
 
   json in = {{"array", {1, 2, 3, 4}}};
   json params, out;
@@ -77,11 +135,70 @@ int main(int argc, char *argv[]) {
   for (auto &[k, v]: filter->info()) {
     cout << k << ": " << v << endl;
   }
-  filter->load_data(in);
-  filter->process(out);
-  cout << "Input: " << in << endl;
-  cout << "Output: " << out << endl;
-  delete filter;
+  // with a "checkpoint" file, the filter state is restored from it, and saved
+  // every "checkpoint_interval" ms and at the end
+  unique_ptr<Checkpointer> checkpointer;
+  if (!params.value("checkpoint", "").empty()) {
+    checkpointer = make_unique<Checkpointer>(
+      params["checkpoint"].get<string>(),
+      chrono::milliseconds(params.value("checkpoint_interval", 10000)));
+    auto start = chrono::steady_clock::now();
+    if (checkpointer->restore(*filter)) {
+      cout << "Restored state from " << checkpointer->path() << " ("
+           << checkpointer->bytes() << " bytes) in "
+           << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()
+           << " ms" << endl;
+    } else {
+      cout << "No state restored: " << checkpointer->error() << endl;
+    }
+  }
+  // with "hot_reload": true, the filter is replaced when the plugin file
+  // changes, keeping its state
+  bool hot_reload = params.value("hot_reload", false);
+  unique_ptr<HotReload<json, json>> reloader;
+  if (hot_reload) {
+    reloader = make_unique<HotReload<json, json>>(argv[1], driver->name(), params, filter);
+  }
+  // With a period (ms) in the parameters, the input is processed
+  // periodically, for the given number of iterations (0 means forever)
+  long long period = params.value("period", hot_reload ? 1000LL : 0LL);
+  size_t iterations = params.value("iterations", hot_reload ? 0 : (period > 0 ? 10 : 1));
+  Ticker ticker(chrono::milliseconds(period),
+                Ticker::policy(params.value("overrun", "skip")));
+  string reload_error;
+  for (size_t i = 0; iterations == 0 || i < iterations; i++) {
+    if (i > 0) ticker.wait();
+    if (reloader) {
+      if (reloader->update()) {
+        filter = reloader->filter();
+        json stats = reloader->stats();
+        cout << "Reloaded " << argv[1] << ", switchover pause " << stats["last_pause_ms"]
+             << " ms, state " << (stats["state_transferred"] ? "kept" : "reset") << endl;
+      }
+      if (reloader->error() != reload_error) {
+        reload_error = reloader->error();
+        if (!reload_error.empty()) cout << "Reload failed: " << reload_error << endl;
+      }
+    }
+    json stamped = in;
+    // with "timestamps": true, the input is stamped as if coming from a source
+    if (params.value("timestamps", false)) Timestamps::depart(stamped, "load_filter");
+    filter->stamp_arrival(stamped);
+    filter->load_data(stamped);
+    filter->process(out);
+    filter->stamp(stamped, out);
+    if (checkpointer) checkpointer->tick(*filter);
+    cout << "Input: " << stamped << endl;
+    cout << "Output: " << out << endl;
+  }
+  if (checkpointer && !checkpointer->save(*filter))
+    cout << "Checkpoint not saved: " << checkpointer->error() << endl;
+  if (reloader) {
+    cout << "Hot reload: " << reloader->stats() << endl;
+    reloader.reset(); // owns the filter
+  } else {
+    delete filter;
+  }
 
   kernel.clear_drivers();
 }
\ No newline at end of file
@@ -5,6 +5,12 @@
 #include <thread>
 #include <vector>
 #include <fstream>
+#include <filesystem>
+#include <chrono>
+#include "../plugin_index.hpp"
+#ifdef MADS_STATIC_PLUGINS
+#include "../registry.hpp"
+#endif
 
 using namespace std;
 
@@ -13,6 +19,7 @@ using SinkJ = Sink<json>;
 using SinkDriverJ = SinkDriver<json>;
 
 int main(int argc, char *argv[]) {
+  auto startup = chrono::steady_clock::now();
   pugg::Kernel kernel;
   string json_file = "";
   // add a generic server to the kernel to initilize it
@@ -27,9 +34,53 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  // with a directory, the plugin providing the named driver is found through
+  // a cached index, and only that one is loaded: the arguments become
+  // <plugin> [json], or <plugin> <name> [json] if it has more drivers
+  vector<char *> args(argv, argv + argc);
+  string plugin_path;
+  if (filesystem::is_directory(argv[1])) {
+    if (argc < 3) {
+      cout << "Usage: " << argv[0] << " <plugin dir> <name> [json]" << endl;
+      return 1;
+    }
+    PluginIndex index(argv[1]);
+    if (!index.scan()) {
+      cout << index.error() << endl;
+      return 1;
+    }
+    cout << "Plugin index: " << index.stats() << endl;
+    plugin_path = index.find(SinkJ::server_name(), argv[2]).string();
+    if (plugin_path.empty()) {
+      cout << "No driver " << argv[2] << " in " << argv[1] << ", available:" << endl;
+      for (auto &d : index.drivers(SinkJ::server_name()))
+        cout << " - " << d["name"].get<string>() << " (" << d["file"].get<string>() << ")" << endl;
+      return 1;
+    }
+    args[1] = plugin_path.data();
+    size_t n = 0;
+    string file = filesystem::path(plugin_path).filename().string();
+    for (auto &d : index.drivers(SinkJ::server_name())) n += d["file"] == file;
+    if (n == 1) args.erase(args.begin() + 2);
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+  }
+
   cout << "Loading plugin... ";
   cout.flush();
   // load the plugin
+#ifdef MADS_STATIC_PLUGINS
+  // plugins built into the executable are selected by name (a path to a
+  // missing file also selects the built-in plugin with the same name)
+  if (!filesystem::exists(argv[1])) {
+    string name = filesystem::path(argv[1]).stem().string();
+    if (Registry::install(kernel, SinkJ::server_name(), name) == 0) {
+      cout << "\nNo plugin " << argv[1] << ", built-in plugins:" << endl;
+      for (auto &n : Registry::names(SinkJ::server_name())) cout << " - " << n << endl;
+      return 1;
+    }
+  } else
+#endif
   kernel.load_plugin(argv[1]);
 
   // find the proper driver in the plugin
@@ -64,6 +115,9 @@ int main(int argc, char *argv[]) {
   SinkJ *sink = driver->create();
   // Now we can create an instance of class SinkJ from the driver
   cout << "\nLoaded plugin: " << sink->kind() << endl;
+  cout << "Startup time: "
+       << chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count()
+       << " ms" << endl;
 
   json in = {{"array", {1, 2, 3, 4}}};
   json params;
@@ -77,8 +131,13 @@ int main(int argc, char *argv[]) {
   for (auto &[k, v]: sink->info()) {
     cout << k << ": " << v << endl;
   }
+  // with "timestamps": true, the input is stamped as if coming from a source
+  if (params.value("timestamps", false)) Timestamps::depart(in, "load_sink");
+  sink->stamp_arrival(in);
   sink->load_data(in);
   cout << "Input: " << in << endl;
+  if (params.value("timestamps", false))
+    cout << "Latency (ms): " << sink->latency(in) << endl;
   delete sink;
 
   kernel.clear_drivers();
@@ -1,10 +1,17 @@
 #include "../source.hpp"
+#include "../ticker.hpp"
 #include <iostream>
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
 #include <thread>
 #include <vector>
 #include <fstream>
+#include <filesystem>
+#include <chrono>
+#include "../plugin_index.hpp"
+#ifdef MADS_STATIC_PLUGINS
+#include "../registry.hpp"
+#endif
 
 using namespace std;
 
@@ -13,6 +20,7 @@ using SourceJ = Source<json>;
 using SourceDriverJ = SourceDriver<json>;
 
 int main(int argc, char *argv[]) {
+  auto startup = chrono::steady_clock::now();
   pugg::Kernel kernel;
   string json_file = "";
   // add a generic server to the kernel to initilize it
@@ -27,9 +35,53 @@ int main(int argc, char *argv[]) {
     return 1;
   }
 
+  // with a directory, the plugin providing the named driver is found through
+  // a cached index, and only that one is loaded: the arguments become
+  // <plugin> [json], or <plugin> <name> [json] if it has more drivers
+  vector<char *> args(argv, argv + argc);
+  string plugin_path;
+  if (filesystem::is_directory(argv[1])) {
+    if (argc < 3) {
+      cout << "Usage: " << argv[0] << " <plugin dir> <name> [json]" << endl;
+      return 1;
+    }
+    PluginIndex index(argv[1]);
+    if (!index.scan()) {
+      cout << index.error() << endl;
+      return 1;
+    }
+    cout << "Plugin index: " << index.stats() << endl;
+    plugin_path = index.find(SourceJ::server_name(), argv[2]).string();
+    if (plugin_path.empty()) {
+      cout << "No driver " << argv[2] << " in " << argv[1] << ", available:" << endl;
+      for (auto &d : index.drivers(SourceJ::server_name()))
+        cout << " - " << d["name"].get<string>() << " (" << d["file"].get<string>() << ")" << endl;
+      return 1;
+    }
+    args[1] = plugin_path.data();
+    size_t n = 0;
+    string file = filesystem::path(plugin_path).filename().string();
+    for (auto &d : index.drivers(SourceJ::server_name())) n += d["file"] == file;
+    if (n == 1) args.erase(args.begin() + 2);
+    argc = static_cast<int>(args.size());
+    argv = args.data();
+  }
+
   cout << "Loading plugin... ";
   cout.flush();
   // load the plugin
+#ifdef MADS_STATIC_PLUGINS
+  // plugins built into the executable are selected by name (a path to a
+  // missing file also selects the built-in plugin with the same name)
+  if (!filesystem::exists(argv[1])) {
+    string name = filesystem::path(argv[1]).stem().string();
+    if (Registry::install(kernel, SourceJ::server_name(), name) == 0) {
+      cout << "\nNo plugin " << argv[1] << ", built-in plugins:" << endl;
+      for (auto &n : Registry::names(SourceJ::server_name())) cout << " - " << n << endl;
+      return 1;
+    }
+  } else
+#endif
   kernel.load_plugin(argv[1]);
 
   // find the proper driver in the plugin
@@ -64,6 +116,9 @@ int main(int argc, char *argv[]) {
   SourceJ *source = driver->create();
   // Now we can create an instance of class SourceJ from the driver
   cout << "\nLoaded plugin: " << source->kind() << endl;
+  cout << "Startup time: "
+       << chrono::duration<double, milli>(chrono::steady_clock::now() - startup).count()
+       << " ms" << endl;
 
   json params, out;
   if (argc == 3) {
@@ -77,8 +132,28 @@ int main(int argc, char *argv[]) {
   for (auto &p: source->info()) {
     cout << p.first << ": " << p.second << endl;
   }
-  source->get_output(out);
-  cout << "Output: " << out << endl;
+
+  // With a period (ms) in the parameters, get_output() is called 
+  // periodically, for the given number of iterations (0 means forever)
+  long long period = params.value("period", 0LL);
+  size_t iterations = params.value("iterations", period > 0 ? 10 : 1);
+  Ticker ticker(chrono::milliseconds(period), 
+                Ticker::policy(params.value("overrun", "skip")));
+  for (size_t i = 0; iterations == 0 || i < iterations; i++) {
+    if (i > 0) ticker.wait();
+    source->get_output(out);
+    source->stamp(out);
+    cout << "Output: " << out << endl;
+    // the source may ask for a different period from now on
+    if (source->next_loop_duration.count() > 0 && 
+        source->next_loop_duration != ticker.period()) {
+      ticker.set_period(source->next_loop_duration);
+    }
+  }
+  if (ticker.ticks() > 0) {
+    cout << "Jitter (us): " << ticker.jitter().summary() << endl;
+    cout << "Overruns: " << ticker.overruns() << endl;
+  }
   delete source;
 
   kernel.clear_drivers();
@@ -13,6 +13,8 @@ Produces current time and date
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
 #include <sstream>
+#include <cstring>
+#include <ctime>
 
 #ifndef PLUGIN_NAME
 #define PLUGIN_NAME "clock"
@@ -29,30 +31,63 @@ public:
   string kind() override { return PLUGIN_NAME; }
 
   static string get_ISO8601(const system_clock::time_point &time) {
-    time_t tt = system_clock::to_time_t(time);
-    tm *tt2 = localtime(&tt);
-
-    // Get milliseconds hack
-    auto timeTruncated = system_clock::from_time_t(tt);
-    int ms =
-        std::chrono::duration_cast<milliseconds>(time - timeTruncated).count();
-
-    return (
-               stringstream()
-               << put_time(tt2, "%FT%T")               // "2023-03-30T19:49:53"
-               << "." << setw(3) << setfill('0') << ms // ".005"
-               << put_time(tt2, "%z") // "+0200" (time zone offset, optional)
-               )
-        .str();
+    char buf[32];
+    return string(buf, format_ISO8601(time, buf));
+  }
+
+  // Writes the time as "2023-03-30T19:49:53.005+0200" into buf (at least 29
+  // chars) and returns the length. Calling localtime() and formatting the
+  // date is by far the most expensive part, so the date/time prefix and the 
+  // time zone offset are cached and only updated when the second changes: 
+  // most of the times, only the milliseconds are written.
+  static size_t format_ISO8601(const system_clock::time_point &time, char *buf) {
+    struct Cache {
+      time_t second = -1;
+      char prefix[24];  // "2023-03-30T19:49:53"
+      size_t prefix_len = 0;
+      char zone[8];     // "+0200"
+      size_t zone_len = 0;
+    };
+    thread_local Cache cache;
+
+    auto ms_total = duration_cast<milliseconds>(time.time_since_epoch()).count();
+    time_t tt = static_cast<time_t>(ms_total / 1000);
+    int ms = static_cast<int>(ms_total % 1000);
+    if (ms < 0) {
+      ms += 1000;
+      tt -= 1;
+    }
+    if (tt != cache.second) {
+      tm local;
+#ifdef _WIN32
+      localtime_s(&local, &tt);
+#else
+      localtime_r(&tt, &local);
+#endif
+      cache.prefix_len = strftime(cache.prefix, sizeof(cache.prefix), "%Y-%m-%dT%H:%M:%S", &local);
+      cache.zone_len = strftime(cache.zone, sizeof(cache.zone), "%z", &local);
+      cache.second = tt;
+    }
+    char *p = buf;
+    memcpy(p, cache.prefix, cache.prefix_len);
+    p += cache.prefix_len;
+    *p++ = '.';
+    *p++ = '0' + ms / 100;
+    *p++ = '0' + ms / 10 % 10;
+    *p++ = '0' + ms % 10;
+    memcpy(p, cache.zone, cache.zone_len);
+    p += cache.zone_len;
+    return p - buf;
   }
 
   return_type get_output(json &out,
                          std::vector<unsigned char> *blob = nullptr) override {
     auto now = chrono::system_clock::now();
+    char buf[32];
     out.clear();
     out["time_raw"] = now.time_since_epoch().count();
-    out["time"] = get_ISO8601(now);
-    out["params"] = _params;
+    out["time"] = string(buf, format_ISO8601(now, buf));
+    if (_with_params) out["params"] = _params;
     if (!_agent_id.empty()) out["agent_id"] = _agent_id;
     return return_type::success;
   }
@@ -60,12 +95,15 @@ public:
   void set_params(const json &params) override {
     Source::set_params(params);
     _params.merge_patch(params);
+    // set with_params to false to leave the parameters out of the output
+    _with_params = _params.value("with_params", true);
   }
 
   map<string, string> info() override { return {}; };
 
 private:
   json _data, _params;
+  bool _with_params = true;
 };
 
 /*
@@ -98,5 +136,15 @@ int main(int argc, char const *argv[]) {
   // Produce output
   cout << "Clock: " << output << endl;
 
+  // With a number as argument, measure the time spent producing the output
+  if (argc > 1) {
+    long n = atol(argv[1]);
+    clock.set_params({{"with_params", false}});
+    auto start = steady_clock::now();
+    for (long i = 0; i < n; i++) clock.get_output(output);
+    duration<double, nano> elapsed = steady_clock::now() - start;
+    cout << "Clock: " << elapsed.count() / n << " ns per output" << endl;
+  }
+
   return 0;
 }
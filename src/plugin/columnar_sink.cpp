@@ -0,0 +1,363 @@
+/*
+   ____      _                                        _       _
+  / ___|___ | |_   _ _ __ ___  _ __   __ _ _ __   ___(_)_ __ | | __
+ | |   / _ \| | | | | '_ ` _ \| '_ \ / _` | '__| / __| | '_ \| |/ /
+ | |__| (_) | | |_| | | | | | | | | | (_| | |    \__ \ | | | |   <
+  \____\___/|_|\__,_|_| |_| |_|_| |_|\__,_|_|    |___/_|_| |_|_|\_\
+
+Writes MADS messages to Parquet or Arrow IPC files, in row groups
+*/
+
+#include "../sink.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <arrow/ipc/writer.h>
+#ifdef HAVE_PARQUET
+#include <parquet/arrow/writer.h>
+#include <parquet/properties.h>
+#endif
+#include <ctime>
+#include <filesystem>
+#include <set>
+#include <unordered_map>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "columnar_sink"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// Each message is flattened into dotted field names (nested objects only;
+// arrays are stored as JSON strings) and its values appended to per-field
+// columns, together with the `topic`. Column types are inferred from the
+// values and promoted as needed: null < bool < int64 < double < string
+// (where anything mixed with strings becomes its JSON text). Fields missing
+// in a message are null. Every `row_group_size` rows, the columns are
+// converted into an Arrow record batch and written as a row group, so memory
+// is bounded by the row group size. A file has a single schema: when the
+// schema of a row group differs (new fields or promoted types), a new file
+// is started.
+class ColumnarSink : public Sink<json> {
+  enum class type { null, boolean, int64, float64, string };
+  struct Column {
+    string name;
+    type t = type::null;
+    vector<json> values;
+  };
+
+public:
+  ~ColumnarSink() {
+    flush();
+    close();
+  }
+
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    append("topic", topic);
+    flatten(d, "");
+    _rows++;
+    // fields missing in this message
+    for (auto &c : _columns) {
+      if (c.values.size() < _rows) c.values.emplace_back(nullptr);
+    }
+    if (_rows >= _row_group_size && !flush()) return return_type::error;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["path"] = "output";      // file name prefix, may include dirs
+#ifdef HAVE_PARQUET
+    _params["format"] = "parquet";   // parquet or arrow
+#else
+    _params["format"] = "arrow";
+#endif
+    _params["row_group_size"] = 65536;
+    _params["compression"] = "zstd"; // parquet: none, snappy, gzip, zstd
+    _params["dictionary"] = {"topic", "agent_id"};
+    _params.merge_patch(params);
+    flush();
+    close();
+    _path = _params["path"].get<string>();
+    _format = _params["format"];
+#ifndef HAVE_PARQUET
+    if (_format == "parquet") {
+      cerr << "columnar_sink: built without Parquet, writing Arrow IPC" << endl;
+      _format = "arrow";
+    }
+#endif
+    _row_group_size = max<size_t>(1, _params["row_group_size"].get<size_t>());
+    _dictionary.clear();
+    for (auto &f : _params["dictionary"]) _dictionary.insert(f.get<string>());
+  }
+
+  map<string, string> info() override {
+    return {
+      {"path", _path.string()},
+      {"format", _format},
+      {"row_group_size", to_string(_row_group_size)},
+      {"columns", to_string(_columns.size())},
+      {"files", to_string(_files)},
+      {"row_groups", to_string(_row_groups)}
+    };
+  };
+
+  // Writes the buffered rows as a row group. Returns false on error.
+  bool flush() {
+    if (_rows == 0) return true;
+    arrow::Status st = write_row_group();
+    for (auto &c : _columns) c.values.clear();
+    _rows = 0;
+    if (!st.ok()) {
+      _error = st.ToString();
+      cerr << "columnar_sink: " << _error << endl;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  // Column buffering ##########################################################
+
+  void flatten(const json &j, const string &prefix) {
+    for (auto &[k, v] : j.items()) {
+      string name = prefix.empty() ? k : prefix + "." + k;
+      if (v.is_object()) {
+        flatten(v, name);
+      } else {
+        append(name, v);
+      }
+    }
+  }
+
+  void append(const string &name, const json &v) {
+    auto it = _index.find(name);
+    if (it == _index.end()) {
+      it = _index.emplace(name, _columns.size()).first;
+      _columns.push_back({name, type::null, {}});
+    }
+    Column &c = _columns[it->second];
+    if (c.values.size() > _rows) return; // duplicate name in the same row
+    c.values.reserve(_row_group_size);
+    c.values.resize(_rows, nullptr);     // column appearing in this row group
+    type t = v.is_null() ? type::null : v.is_boolean() ? type::boolean :
+             v.is_number_integer() ? type::int64 : v.is_number() ? type::float64 : type::string;
+    if (t > c.t) c.t = t;
+    c.values.push_back(v);
+  }
+
+  // Arrow conversion ##########################################################
+
+  shared_ptr<arrow::DataType> arrow_type(const Column &c) const {
+    switch (c.t) {
+    case type::boolean: return arrow::boolean();
+    case type::int64: return arrow::int64();
+    case type::float64: return arrow::float64();
+    case type::string:
+      return _dictionary.count(c.name) ? arrow::dictionary(arrow::int32(), arrow::utf8()) : arrow::utf8();
+    default: return arrow::null();
+    }
+  }
+
+  static string as_string(const json &v) {
+    return v.is_string() ? v.get<string>() : v.dump();
+  }
+
+  arrow::Result<shared_ptr<arrow::Array>> build(const Column &c) const {
+    shared_ptr<arrow::Array> array;
+    switch (c.t) {
+    case type::boolean: {
+      arrow::BooleanBuilder b;
+      ARROW_RETURN_NOT_OK(b.Reserve(c.values.size()));
+      for (auto &v : c.values)
+        ARROW_RETURN_NOT_OK(v.is_null() ? b.AppendNull() : b.Append(v.get<bool>()));
+      ARROW_RETURN_NOT_OK(b.Finish(&array));
+      break;
+    }
+    case type::int64: {
+      arrow::Int64Builder b;
+      ARROW_RETURN_NOT_OK(b.Reserve(c.values.size()));
+      for (auto &v : c.values)
+        ARROW_RETURN_NOT_OK(v.is_null() ? b.AppendNull() : b.Append(v.get<int64_t>()));
+      ARROW_RETURN_NOT_OK(b.Finish(&array));
+      break;
+    }
+    case type::float64: {
+      arrow::DoubleBuilder b;
+      ARROW_RETURN_NOT_OK(b.Reserve(c.values.size()));
+      for (auto &v : c.values)
+        ARROW_RETURN_NOT_OK(v.is_null() ? b.AppendNull() : b.Append(v.get<double>()));
+      ARROW_RETURN_NOT_OK(b.Finish(&array));
+      break;
+    }
+    case type::string:
+      if (_dictionary.count(c.name)) {
+        arrow::StringDictionary32Builder b;
+        for (auto &v : c.values)
+          ARROW_RETURN_NOT_OK(v.is_null() ? b.AppendNull() : b.Append(as_string(v)));
+        ARROW_RETURN_NOT_OK(b.Finish(&array));
+      } else {
+        arrow::StringBuilder b;
+        ARROW_RETURN_NOT_OK(b.Reserve(c.values.size()));
+        for (auto &v : c.values)
+          ARROW_RETURN_NOT_OK(v.is_null() ? b.AppendNull() : b.Append(as_string(v)));
+        ARROW_RETURN_NOT_OK(b.Finish(&array));
+      }
+      break;
+    default: {
+      arrow::NullBuilder b;
+      ARROW_RETURN_NOT_OK(b.AppendNulls(c.values.size()));
+      ARROW_RETURN_NOT_OK(b.Finish(&array));
+    }
+    }
+    return array;
+  }
+
+  // Files #####################################################################
+
+  arrow::Status write_row_group() {
+    arrow::FieldVector fields;
+    arrow::ArrayVector arrays;
+    for (auto &c : _columns) {
+      fields.push_back(arrow::field(c.name, arrow_type(c)));
+      ARROW_ASSIGN_OR_RAISE(auto array, build(c));
+      arrays.push_back(array);
+    }
+    auto schema = arrow::schema(fields);
+    auto batch = arrow::RecordBatch::Make(schema, _rows, arrays);
+    if (!_schema || !_schema->Equals(*schema)) {
+      close();
+      ARROW_RETURN_NOT_OK(open(schema));
+    }
+#ifdef HAVE_PARQUET
+    if (_parquet) {
+      ARROW_ASSIGN_OR_RAISE(auto table, arrow::Table::FromRecordBatches({batch}));
+      ARROW_RETURN_NOT_OK(_parquet->WriteTable(*table, _rows));
+    }
+#endif
+    if (_ipc) ARROW_RETURN_NOT_OK(_ipc->WriteRecordBatch(*batch));
+    _row_groups++;
+    return arrow::Status::OK();
+  }
+
+  arrow::Status open(shared_ptr<arrow::Schema> schema) {
+    char stamp[32];
+    time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    string name = _path.filename().string() + "_" + stamp + "_" + to_string(_files) +
+                  (_format == "parquet" ? ".parquet" : ".arrows");
+    if (!_path.parent_path().empty()) filesystem::create_directories(_path.parent_path());
+    ARROW_ASSIGN_OR_RAISE(_out, arrow::io::FileOutputStream::Open((_path.parent_path() / name).string()));
+#ifdef HAVE_PARQUET
+    if (_format == "parquet") {
+      string c = _params["compression"];
+      auto codec = c == "snappy" ? arrow::Compression::SNAPPY : c == "gzip" ? arrow::Compression::GZIP :
+                   c == "zstd" ? arrow::Compression::ZSTD : arrow::Compression::UNCOMPRESSED;
+      auto props = parquet::WriterProperties::Builder()
+        .compression(codec)
+        ->enable_dictionary()
+        ->max_row_group_length(static_cast<int64_t>(_row_group_size))
+        ->build();
+      auto arrow_props = parquet::ArrowWriterProperties::Builder().store_schema()->build();
+      ARROW_ASSIGN_OR_RAISE(_parquet, parquet::arrow::FileWriter::Open(
+        *schema, arrow::default_memory_pool(), _out, props, arrow_props));
+    } else
+#endif
+    {
+      // The stream format allows dictionaries to change between batches
+      ARROW_ASSIGN_OR_RAISE(_ipc, arrow::ipc::MakeStreamWriter(_out, schema));
+    }
+    _schema = schema;
+    _files++;
+    return arrow::Status::OK();
+  }
+
+  void close() {
+    arrow::Status st;
+#ifdef HAVE_PARQUET
+    if (_parquet) st &= _parquet->Close();
+    _parquet.reset();
+#endif
+    if (_ipc) st &= _ipc->Close();
+    _ipc.reset();
+    if (_out) st &= _out->Close();
+    _out.reset();
+    _schema.reset();
+    if (!st.ok()) cerr << "columnar_sink: " << st.ToString() << endl;
+  }
+
+  json _params;
+  filesystem::path _path;
+  string _format;
+  size_t _row_group_size = 65536;
+  set<string> _dictionary;
+  vector<Column> _columns;
+  unordered_map<string, size_t> _index;
+  size_t _rows = 0, _files = 0, _row_groups = 0;
+  shared_ptr<arrow::Schema> _schema;
+  shared_ptr<arrow::io::FileOutputStream> _out;
+  shared_ptr<arrow::ipc::RecordBatchWriter> _ipc;
+#ifdef HAVE_PARQUET
+  unique_ptr<parquet::arrow::FileWriter> _parquet;
+#endif
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(ColumnarSink, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+int main(int argc, char const *argv[]) {
+  // columnar_sink [n] [parquet|arrow] [path]
+  size_t n = argc > 1 ? atoi(argv[1]) : 100000;
+  ColumnarSink sink;
+  json params = {{"row_group_size", 10000}};
+  if (argc > 2) params["format"] = argv[2];
+  params["path"] = argc > 3 ? argv[3] : (filesystem::temp_directory_path() / "columnar").string();
+  sink.set_params(params);
+
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    json data = {
+      {"agent_id", i % 2 ? "edge1" : "edge2"},
+      {"ts", i},
+      {"data", {{"x", i % 10 == 0 ? json(1) : json(0.5 * i)}, {"ok", i % 3 == 0}}}
+    };
+    // a late field, promoting the schema and starting a new file
+    if (i >= n / 2) data["data"]["label"] = "half";
+    sink.load_data(data, "sensors");
+  }
+  sink.flush();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << n / elapsed.count() << " msg/s" << endl;
+  for (auto &[k, v] : sink.info()) cout << k << ": " << v << endl;
+  return 0;
+}
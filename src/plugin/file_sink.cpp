@@ -0,0 +1,594 @@
+/*
+  _____ _ _            _       _
+ |  ___(_) | ___   ___(_)_ __ | | __
+ | |_  | | |/ _ \ / __| | '_ \| |/ /
+ |  _| | | |  __/ \__ \ | | | |   <
+ |_|   |_|_|\___| |___/_|_| |_|_|\_\
+
+Writes MADS messages to NDJSON or CSV files, with rotation and compression
+*/
+
+#include "../sink.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "file_sink"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Page-aligned memory block, used for the output buffers
+struct AlignedBuffer {
+  static constexpr size_t alignment = 4096;
+  explicit AlignedBuffer(size_t capacity)
+      : capacity((capacity + alignment - 1) & ~(alignment - 1)) {
+#ifdef _WIN32
+    data = static_cast<char *>(_aligned_malloc(this->capacity, alignment));
+#else
+    data = static_cast<char *>(aligned_alloc(alignment, this->capacity));
+#endif
+    if (!data) throw bad_alloc();
+  }
+  ~AlignedBuffer() {
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+  }
+  AlignedBuffer(const AlignedBuffer &) = delete;
+  AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+  char *data = nullptr;
+  size_t capacity = 0;
+  size_t size = 0;
+  bool rotate = false; // close the file after writing this buffer
+};
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// Messages are formatted in load_data() and copied into large page-aligned
+// buffers. Full buffers are handed to a writer thread, which compresses
+// them (gzip or zstd, streaming) and writes them to the current file; a
+// fixed pool of `buffers` buffers bounds memory, and load_data() waits for a
+// free one if the disk cannot keep up. Files are rotated at message
+// boundaries when they exceed `rotate_size` MB (uncompressed) or are older
+// than `rotate_interval` s.
+class FileSink : public Sink<json> {
+public:
+  enum class format { ndjson, csv };
+  enum class compression { none, gzip, zstd };
+  enum class fsync_policy { none, rotate, interval, always };
+
+  ~FileSink() {
+    stop();
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(_zcs);
+#endif
+  }
+
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    if (!_writer.joinable()) {
+      _error = "Sink not configured";
+      return return_type::error;
+    }
+    _line.clear();
+    if (_format == format::csv) {
+      if (_columns.empty()) learn_columns(d);
+      csv_line(d, topic);
+    } else if (_topic_field.empty()) {
+      _line = d.dump();
+      _line += '\n';
+    } else {
+      json j = d;
+      j[_topic_field] = topic;
+      _line = j.dump();
+      _line += '\n';
+    }
+
+    unique_lock<mutex> lock(_mtx);
+    // errors of the writer thread are reported at the next message, which
+    // is still queued
+    return_type result = return_type::success;
+    if (!_write_error.empty()) {
+      _error = _write_error;
+      _write_error.clear();
+      result = return_type::error;
+    }
+    if (!_current) _current = take_buffer(lock);
+    // rotation, at message boundary
+    if (_file_bytes > 0 &&
+        ((_rotate_size > 0 && _file_bytes + _line.size() > _rotate_size) ||
+         (_rotate_interval.count() > 0 && chrono::steady_clock::now() - _file_start >= _rotate_interval))) {
+      _current->rotate = true;
+      submit(lock);
+      _file_bytes = 0;
+    }
+    if (_file_bytes == 0) {
+      _file_start = chrono::steady_clock::now();
+      if (_format == format::csv) append(_header, lock);
+    }
+    append(_line, lock);
+    _messages++;
+    return result;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["path"] = "output";         // file name prefix, may include dirs
+    _params["format"] = "ndjson";       // ndjson or csv
+    _params["compression"] = "none";    // none, gzip or zstd
+    _params["level"] = 3;               // compression level
+    _params["rotate_size"] = 0;         // MB, 0 for no size rotation
+    _params["rotate_interval"] = 0;     // s, 0 for no time rotation
+    _params["fsync"] = "rotate";        // none, rotate, interval, always
+    _params["fsync_interval"] = 1000;   // ms
+    _params["flush_interval"] = 1000;   // ms
+    _params["buffer_size"] = 4096;      // KiB
+    _params["buffers"] = 4;
+    _params["topic_field"] = "";        // ndjson: add the topic in this field
+    _params.merge_patch(params);
+
+    stop();
+    _path = _params["path"].get<string>();
+    _format = _params["format"] == "csv" ? format::csv : format::ndjson;
+    string c = _params["compression"];
+    _compression = c == "gzip" ? compression::gzip : c == "zstd" ? compression::zstd : compression::none;
+#ifndef HAVE_ZLIB
+    if (_compression == compression::gzip) {
+      cerr << "file_sink: built without zlib, writing uncompressed files" << endl;
+      _compression = compression::none;
+    }
+#endif
+#ifndef HAVE_ZSTD
+    if (_compression == compression::zstd) {
+      cerr << "file_sink: built without zstd, writing uncompressed files" << endl;
+      _compression = compression::none;
+    }
+#endif
+    _level = _params["level"];
+    _rotate_size = _params["rotate_size"].get<size_t>() << 20;
+    _rotate_interval = chrono::seconds(_params["rotate_interval"].get<long long>());
+    string f = _params["fsync"];
+    _fsync = f == "none" ? fsync_policy::none : f == "always" ? fsync_policy::always :
+             f == "interval" ? fsync_policy::interval : fsync_policy::rotate;
+    _fsync_interval = chrono::milliseconds(_params["fsync_interval"].get<long long>());
+    _flush_interval = chrono::milliseconds(_params["flush_interval"].get<long long>());
+    _topic_field = _params["topic_field"];
+    _columns.clear();
+    _header.clear();
+
+    size_t capacity = max<size_t>(4, _params["buffer_size"].get<size_t>()) << 10;
+    _buffers.clear();
+    _free.clear();
+    for (size_t i = 0; i < max<size_t>(2, _params["buffers"].get<size_t>()); i++) {
+      _buffers.push_back(make_unique<AlignedBuffer>(capacity));
+      _free.push_back(_buffers.back().get());
+    }
+    _current = nullptr;
+    _file_bytes = 0;
+    _file_start = chrono::steady_clock::now();
+    _stop = false;
+    _writer = thread(&FileSink::write_loop, this);
+  }
+
+  map<string, string> info() override {
+    return {
+      {"path", _path.string()},
+      {"format", _params["format"]},
+      {"compression", _params["compression"]},
+      {"fsync", _params["fsync"]},
+      {"rotate_size", to_string(_rotate_size >> 20) + " MB"},
+      {"rotate_interval", to_string(_rotate_interval.count()) + " s"},
+      {"buffers", to_string(_buffers.size()) + " x " +
+        to_string(_buffers.empty() ? 0 : _buffers[0]->capacity >> 10) + " KiB"},
+      {"stats", stats().dump()}
+    };
+  }
+
+  json stats() const {
+    return {
+      {"messages", _messages.load()},
+      {"bytes_in", _bytes_in.load()},
+      {"bytes_out", _bytes_out.load()},
+      {"files", _files.load()},
+      {"waits", _waits.load()}
+    };
+  }
+
+  // Writes out all the buffered data, and closes the current file
+  void stop() {
+    if (!_writer.joinable()) return;
+    {
+      lock_guard<mutex> lock(_mtx);
+      if (_current && _current->size > 0) {
+        _full.push_back(_current);
+        _current = nullptr;
+      }
+      _stop = true;
+    }
+    _cv_full.notify_one();
+    _writer.join();
+  }
+
+private:
+  // CSV ######################################################################
+
+  // Columns are the flattened fields of the first message, in the order of
+  // the (sorted) JSON keys, plus the topic
+  void learn_columns(const json &d) {
+    _columns.push_back({"topic", json::json_pointer()});
+    json flat = d.flatten();
+    for (auto &[ptr, v] : flat.items()) {
+      string name = ptr.substr(1);
+      replace(name.begin(), name.end(), '/', '.');
+      _columns.push_back({name, json::json_pointer(ptr)});
+    }
+    for (size_t i = 0; i < _columns.size(); i++) {
+      _header += (i ? "," : "") + csv_escape(_columns[i].first);
+    }
+    _header += '\n';
+  }
+
+  void csv_line(const json &d, const string &topic) {
+    _line += csv_escape(topic);
+    for (size_t i = 1; i < _columns.size(); i++) {
+      _line += ',';
+      if (!d.contains(_columns[i].second)) continue;
+      const json &v = d[_columns[i].second];
+      _line += v.is_string() ? csv_escape(v.get_ref<const string &>()) :
+               v.is_null() ? string() : csv_escape(v.dump());
+    }
+    _line += '\n';
+  }
+
+  static string csv_escape(const string &s) {
+    if (s.find_first_of(",\"\n\r") == string::npos) return s;
+    string r = "\"";
+    for (char c : s) {
+      if (c == '"') r += '"';
+      r += c;
+    }
+    return r + '"';
+  }
+
+  // Buffers ##################################################################
+
+  AlignedBuffer *take_buffer(unique_lock<mutex> &lock) {
+    if (_free.empty()) {
+      _waits++;
+      _cv_free.wait(lock, [this] { return !_free.empty(); });
+    }
+    AlignedBuffer *b = _free.front();
+    _free.pop_front();
+    b->size = 0;
+    b->rotate = false;
+    return b;
+  }
+
+  // Copies data into the current buffer, spilling over into new buffers
+  void append(const string &data, unique_lock<mutex> &lock) {
+    size_t done = 0;
+    while (done < data.size()) {
+      size_t n = min(data.size() - done, _current->capacity - _current->size);
+      memcpy(_current->data + _current->size, data.data() + done, n);
+      _current->size += n;
+      done += n;
+      if (_current->size == _current->capacity) submit(lock);
+    }
+    _file_bytes += data.size();
+    _bytes_in += data.size();
+  }
+
+  void submit(unique_lock<mutex> &lock) {
+    _full.push_back(_current);
+    _current = nullptr; // the writer must not flush it again while we wait
+    _cv_full.notify_one();
+    _current = take_buffer(lock);
+  }
+
+  // Writer thread ############################################################
+
+  void write_loop() {
+    auto last_sync = chrono::steady_clock::now();
+    unique_lock<mutex> lock(_mtx);
+    while (true) {
+      _cv_full.wait_for(lock, _flush_interval, [this] { return _stop || !_full.empty(); });
+      // on timeout, write out the partially filled buffer
+      if (_full.empty() && _current && _current->size > 0) {
+        _full.push_back(_current);
+        _current = nullptr;
+      }
+      if (_full.empty()) {
+        if (_stop) break;
+        continue;
+      }
+      AlignedBuffer *b = _full.front();
+      _full.pop_front();
+      lock.unlock();
+      write(b->data, b->size);
+      if (_fsync == fsync_policy::always ||
+          (_fsync == fsync_policy::interval && chrono::steady_clock::now() - last_sync >= _fsync_interval)) {
+        sync();
+        last_sync = chrono::steady_clock::now();
+      }
+      if (b->rotate) close();
+      lock.lock();
+      _free.push_back(b);
+      _cv_free.notify_one();
+    }
+    lock.unlock();
+    close();
+  }
+
+  void open() {
+    char stamp[32];
+    time_t now = time(nullptr);
+    tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+    string name = _path.filename().string() + "_" + stamp + "_" + to_string(_files.load()) +
+                  (_format == format::csv ? ".csv" : ".ndjson") +
+                  (_compression == compression::gzip ? ".gz" : _compression == compression::zstd ? ".zst" : "");
+    filesystem::path file = _path.parent_path() / name;
+    if (!_path.parent_path().empty()) filesystem::create_directories(_path.parent_path());
+    _file = fopen(file.string().c_str(), "wb");
+    if (!_file) {
+      cerr << "file_sink: cannot open " << file << endl;
+      lock_guard<mutex> lock(_mtx);
+      _write_error = "file_sink: cannot open " + file.string();
+      return;
+    }
+    setvbuf(_file, nullptr, _IONBF, 0); // we do our own buffering
+    _files++;
+#ifdef HAVE_ZLIB
+    if (_compression == compression::gzip) {
+      _zs = z_stream{};
+      deflateInit2(&_zs, _level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY); // gzip header
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (_compression == compression::zstd) {
+      if (!_zcs) _zcs = ZSTD_createCCtx();
+      ZSTD_CCtx_reset(_zcs, ZSTD_reset_session_only);
+      ZSTD_CCtx_setParameter(_zcs, ZSTD_c_compressionLevel, _level);
+    }
+#endif
+  }
+
+  void write(const char *data, size_t size) {
+    if (size == 0) return;
+    if (!_file) open();
+    if (!_file) return;
+    switch (_compression) {
+#ifdef HAVE_ZLIB
+    case compression::gzip:
+      deflate_chunk(data, size, Z_NO_FLUSH);
+      break;
+#endif
+#ifdef HAVE_ZSTD
+    case compression::zstd:
+      zstd_chunk(data, size, ZSTD_e_continue);
+      break;
+#endif
+    default:
+      put(data, size);
+    }
+  }
+
+  void put(const char *data, size_t size) {
+    if (size == 0) return;
+    size_t n = fwrite(data, 1, size, _file);
+    _bytes_out += n;
+    if (n < size) {
+      lock_guard<mutex> lock(_mtx);
+      _write_error = string("file_sink: short write (") + strerror(errno) + ")";
+    }
+  }
+
+#ifdef HAVE_ZLIB
+  void deflate_chunk(const char *data, size_t size, int flush) {
+    _zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+    _zs.avail_in = static_cast<uInt>(size);
+    _out.resize(1 << 18);
+    int ret;
+    do {
+      _zs.next_out = reinterpret_cast<Bytef *>(_out.data());
+      _zs.avail_out = static_cast<uInt>(_out.size());
+      ret = deflate(&_zs, flush);
+      put(_out.data(), _out.size() - _zs.avail_out);
+    } while (_zs.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+  }
+#endif
+
+#ifdef HAVE_ZSTD
+  void zstd_chunk(const char *data, size_t size, ZSTD_EndDirective mode) {
+    ZSTD_inBuffer in = {data, size, 0};
+    _out.resize(ZSTD_CStreamOutSize());
+    size_t remaining;
+    do {
+      ZSTD_outBuffer out = {_out.data(), _out.size(), 0};
+      remaining = ZSTD_compressStream2(_zcs, &out, &in, mode);
+      if (ZSTD_isError(remaining)) {
+        cerr << "file_sink: " << ZSTD_getErrorName(remaining) << endl;
+        return;
+      }
+      put(_out.data(), out.pos);
+    } while (mode == ZSTD_e_end ? remaining != 0 : in.pos < in.size);
+  }
+#endif
+
+  // Ends the compressed stream and closes the file
+  void close() {
+    if (!_file) return;
+#ifdef HAVE_ZLIB
+    if (_compression == compression::gzip) {
+      deflate_chunk(nullptr, 0, Z_FINISH);
+      deflateEnd(&_zs);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (_compression == compression::zstd) zstd_chunk(nullptr, 0, ZSTD_e_end);
+#endif
+    if (_fsync != fsync_policy::none) sync();
+    fclose(_file);
+    _file = nullptr;
+  }
+
+  void sync() {
+    if (!_file) return;
+#ifdef _WIN32
+    _commit(_fileno(_file));
+#else
+    fsync(fileno(_file));
+#endif
+  }
+
+  json _params;
+  filesystem::path _path;
+  format _format = format::ndjson;
+  compression _compression = compression::none;
+  int _level = 3;
+  size_t _rotate_size = 0;
+  chrono::seconds _rotate_interval{0};
+  fsync_policy _fsync = fsync_policy::rotate;
+  chrono::milliseconds _fsync_interval{1000}, _flush_interval{1000};
+  string _topic_field;
+  vector<pair<string, json::json_pointer>> _columns;
+  string _header, _line;
+
+  // buffers, shared with the writer thread under _mtx
+  vector<unique_ptr<AlignedBuffer>> _buffers;
+  deque<AlignedBuffer *> _free, _full;
+  AlignedBuffer *_current = nullptr;
+  mutex _mtx;
+  condition_variable _cv_full, _cv_free;
+  thread _writer;
+  bool _stop = false;
+  string _write_error; // set by the writer thread
+  size_t _file_bytes = 0;
+  chrono::steady_clock::time_point _file_start;
+
+  // writer thread only
+  FILE *_file = nullptr;
+  vector<char> _out;
+#ifdef HAVE_ZLIB
+  z_stream _zs{};
+#endif
+#ifdef HAVE_ZSTD
+  ZSTD_CCtx *_zcs = nullptr;
+#endif
+
+  atomic<size_t> _messages{0}, _bytes_in{0}, _bytes_out{0}, _files{0}, _waits{0};
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(FileSink, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+int main(int argc, char const *argv[]) {
+  // Benchmark: file_sink [n] [format] [compression] [dir]
+  size_t n = argc > 1 ? atoi(argv[1]) : 1000000;
+  string fmt = argc > 2 ? argv[2] : "ndjson";
+  string comp = argc > 3 ? argv[3] : "none";
+  filesystem::path dir = argc > 4 ? argv[4] : filesystem::temp_directory_path() / "file_sink_bench";
+  filesystem::create_directories(dir);
+  json data = {
+    {"ts", "2024-01-01T00:00:00.000+0100"},
+    {"data", {{"x", 1.5}, {"y", -2.25}, {"z", 1000}, {"label", "sample"}}}
+  };
+  auto report = [n](const string &what, chrono::duration<double> dt, size_t bytes) {
+    cout << what << ": " << n / dt.count() << " msg/s, "
+         << bytes / dt.count() / 1e6 << " MB/s" << endl;
+  };
+
+  // Baseline: to_console-like output, one flushed line per message
+  {
+    ofstream out(dir / "baseline.ndjson");
+    size_t bytes = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      data["data"]["z"] = i;
+      string line = "[bench] Data: " + data.dump();
+      bytes += line.size() + 1;
+      out << line << endl;
+    }
+    report("to_console (endl)", chrono::steady_clock::now() - start, bytes);
+  }
+
+  FileSink sink;
+  sink.set_params({
+    {"path", (dir / "bench").string()}, {"format", fmt}, {"compression", comp},
+    {"rotate_size", 64}
+  });
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    data["data"]["z"] = i;
+    sink.load_data(data, "bench");
+  }
+  sink.stop();
+  json stats = sink.stats();
+  report("file_sink (" + fmt + ", " + comp + ")", chrono::steady_clock::now() - start,
+         stats["bytes_in"].get<size_t>());
+  cout << "Stats: " << stats << endl;
+  cout << "Files in " << dir << endl;
+  return 0;
+}
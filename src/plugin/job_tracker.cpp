@@ -0,0 +1,269 @@
+/*
+      _       _       _                  _
+     | | ___ | |__   | |_ _ __ __ _  ___| | _____ _ __
+  _  | |/ _ \| '_ \  | __| '__/ _` |/ __| |/ / _ \ '__|
+ | |_| | (_) | |_) | | |_| | | (_| | (__|   <  __/ |
+  \___/ \___/|_.__/   \__|_|  \__,_|\___|_|\_\___|_|
+
+It correlates spawner jobs with worker results, measuring end-to-end latency
+*/
+
+#include "../sink.hpp"
+#include "../histogram.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <chrono>
+#include <deque>
+#include <list>
+#include <random>
+#include <thread>
+#include <unordered_map>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "job_tracker"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// The sink subscribes to both the spawner and the worker topics. Job
+// requests (with `data.id`) are recorded with their spawn time: the
+// `intended` send time when the spawner is rate-driven, else the `sent`
+// time, else the arrival time here. Results (with `id` and `elapsed`,
+// possibly in a `batch`) are matched to their request, giving:
+// - total: from spawn to the arrival of the result here;
+// - service: the `elapsed` time reported by the worker;
+// - queueing: total minus service (waiting and transit).
+// Pending requests are kept in a hash map indexed by id, bounded in size
+// (`max_pending`) and age (`ttl`): evicted requests are counted as lost.
+// Every `summary_period` ms a JSON summary of the last window (histograms
+// and per-agent throughput) is printed on a line.
+class JobTracker : public Sink<json> {
+  using clock = chrono::steady_clock;
+  struct Window {
+    Histogram total{1e-3, 1e7}, service{1e-3, 1e7}, queueing{1e-3, 1e7};
+    map<string, size_t> per_agent;
+    void reset() {
+      total.reset();
+      service.reset();
+      queueing.reset();
+      per_agent.clear();
+    }
+  };
+
+public:
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    long long now = system_ns();
+    if (d.contains("data") && d["data"].is_object() && d["data"].contains("id")) {
+      spawned(d["data"], now);
+    } else if (d.contains("batch") && d["batch"].is_array()) {
+      for (auto &r : d["batch"]) completed(r, now);
+    } else if (d.contains("id") && d.contains("elapsed")) {
+      completed(d, now);
+    } else {
+      _ignored++;
+    }
+    expire();
+    if (clock::now() - _window_start >= _summary_period) {
+      cout << summary(_window) << endl;
+      _window.reset();
+      _window_start = clock::now();
+    }
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["max_pending"] = 100000;
+    _params["ttl"] = 60000;            // ms
+    _params["summary_period"] = 5000;  // ms
+    _params.merge_patch(params);
+    _max_pending = _params["max_pending"];
+    _ttl = chrono::milliseconds(_params["ttl"].get<long long>());
+    _summary_period = chrono::milliseconds(_params["summary_period"].get<long long>());
+    _pending.reserve(min<size_t>(_max_pending, 1 << 16));
+    _window_start = clock::now();
+  }
+
+  map<string, string> info() override {
+    return {
+      {"max_pending", to_string(_max_pending)},
+      {"ttl", to_string(_ttl.count()) + " ms"},
+      {"summary_period", to_string(_summary_period.count()) + " ms"},
+      {"pending", to_string(_pending.size())},
+      {"summary", summary(_cumulative).dump()}
+    };
+  };
+
+  // Summary of a window, or of the whole run
+  json summary(const Window &w) const {
+    json s = {
+      {"completed", w.total.count()},
+      {"pending", _pending.size()},
+      {"lost", _lost},
+      {"unmatched", _unmatched},
+      {"ignored", _ignored},
+      {"total", w.total.summary()},
+      {"service", w.service.summary()},
+      {"queueing", w.queueing.summary()},
+      {"throughput", json::object()}
+    };
+    double secs = &w == &_cumulative
+      ? chrono::duration<double>(clock::now() - _start).count()
+      : chrono::duration<double>(clock::now() - _window_start).count();
+    for (auto &[agent, n] : w.per_agent)
+      s["throughput"][agent] = secs > 0 ? n / secs : 0.0; // jobs/s
+    return s;
+  }
+
+  const Window &cumulative() const { return _cumulative; }
+
+private:
+  static long long system_ns() {
+    return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  // Key of a job id: strings as they are, numbers as their JSON text; empty
+  // for ids of other types
+  static string key(const json &id) {
+    if (id.is_string()) return id.get<string>();
+    if (id.is_number()) return id.dump();
+    return "";
+  }
+
+  static long long time_field(const json &data, const char *name, long long def) {
+    auto it = data.find(name);
+    return it != data.end() && it->is_number() ? it->get<long long>() : def;
+  }
+
+  void spawned(const json &data, long long now) {
+    string id = key(data["id"]);
+    if (id.empty()) {
+      _ignored++;
+      return;
+    }
+    long long t = time_field(data, "intended", time_field(data, "sent", now));
+    if (_pending.size() >= _max_pending) evict_oldest();
+    auto [it, added] = _pending.emplace(id, Pending{t, {}});
+    if (added) it->second.order = _order.insert(_order.end(), {id, clock::now()});
+  }
+
+  void completed(const json &r, long long now) {
+    string id = r.is_object() && r.contains("id") ? key(r["id"]) : "";
+    if (id.empty()) {
+      _ignored++;
+      return;
+    }
+    auto it = _pending.find(id);
+    if (it == _pending.end()) {
+      _unmatched++;
+      return;
+    }
+    double total = (now - it->second.spawned) / 1.0e6;
+    double service = r.contains("elapsed") && r["elapsed"].is_number() ? r["elapsed"].get<double>() : 0.0;
+    double queueing = max(0.0, total - service);
+    string agent = r.contains("agent_id") && r["agent_id"].is_string() ? r["agent_id"].get<string>() : "unknown";
+    for (Window *w : {&_window, &_cumulative}) {
+      w->total.add(total);
+      w->service.add(service);
+      w->queueing.add(queueing);
+      w->per_agent[agent]++;
+    }
+    _order.erase(it->second.order);
+    _pending.erase(it);
+  }
+
+  // Drops the pending requests older than the TTL. _order holds the pending
+  // ids in insertion order; completed ones are removed from it right away.
+  void expire() {
+    auto limit = clock::now() - _ttl;
+    while (!_order.empty() && _order.front().second < limit) evict_oldest();
+  }
+
+  void evict_oldest() {
+    if (_order.empty()) return;
+    _pending.erase(_order.front().first);
+    _order.pop_front();
+    _lost++;
+  }
+
+  json _params;
+  size_t _max_pending = 0;
+  chrono::milliseconds _ttl, _summary_period;
+  using Order = list<pair<string, clock::time_point>>;
+  struct Pending {
+    long long spawned; // system ns
+    Order::iterator order;
+  };
+  unordered_map<string, Pending> _pending;
+  Order _order;
+  Window _window, _cumulative;
+  clock::time_point _start = clock::now(), _window_start = clock::now();
+  size_t _lost = 0, _unmatched = 0, _ignored = 0;
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(JobTracker, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+int main(int argc, char const *argv[]) {
+  JobTracker tracker;
+  json params = {{"summary_period", 500}, {"ttl", 2000}};
+  tracker.set_params(params);
+
+  // Simulate jobs: spawned every 10 ms, served by two workers in 5-50 ms,
+  // after 0-20 ms of queueing; one job in 20 is lost
+  size_t n = argc > 1 ? atoi(argv[1]) : 200;
+  mt19937 rng(1);
+  uniform_real_distribution<double> service(5, 50), queueing(0, 20);
+  deque<pair<chrono::steady_clock::time_point, json>> results;
+  auto now_ns = [] {
+    return chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+  };
+  for (size_t i = 0; i < n; i++) {
+    string id = "job-" + to_string(i);
+    tracker.load_data({{"data", {{"id", id}, {"sent", now_ns()}}}}, "spawner");
+    double s = service(rng), q = queueing(rng);
+    if (i % 20 != 19) {
+      results.emplace_back(
+        chrono::steady_clock::now() + chrono::microseconds(long((s + q) * 1000)),
+        json{{"id", id}, {"elapsed", s}, {"agent_id", i % 2 ? "w1" : "w2"}});
+    }
+    this_thread::sleep_for(chrono::milliseconds(10));
+    while (!results.empty() && results.front().first <= chrono::steady_clock::now()) {
+      tracker.load_data(results.front().second, "worker");
+      results.pop_front();
+    }
+  }
+  cout << "Cumulative: " << tracker.summary(tracker.cumulative()).dump(2) << endl;
+  return 0;
+}
@@ -9,11 +9,15 @@ Acts as a bridge with a MQTT network
 */
 
 #include "../source.hpp"
+#include "../topic_trie.hpp"
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
 #include <mosquittopp.h>
 #include <sstream>
 #include <thread>
+#include <deque>
+#include <chrono>
+#include <algorithm>
 
 #ifndef PLUGIN_NAME
 #define PLUGIN_NAME "mqtt_bridge"
@@ -25,6 +29,28 @@ using json = nlohmann::json;
 
 
 class MQTTBridge : public Source<json>, public mosquittopp {
+
+  // A message received from the broker and waiting to be returned by
+  // get_output()
+  struct Message {
+    string topic;
+    json data;
+    vector<unsigned char> blob;
+    string blob_format;
+    bool valid;
+    string mqtt_topic; // original topic, when renamed by a subscription
+  };
+
+  // An entry of the subscription table: messages matching filter are
+  // forwarded with the given topic (or the MQTT one, if empty), and with
+  // only the given fields (or all, if empty)
+  struct Subscription {
+    string filter;
+    string topic;
+    int qos;
+    vector<pair<string, json::json_pointer>> fields;
+  };
+
 public:
   string kind() override { return PLUGIN_NAME; }
 
@@ -39,18 +65,20 @@ public:
 
   return_type setup() {
     return_type status = return_type::success;
-    if (_connected) return status;
+    if (_initialized) return status;
     string host = _params["broker_host"];
-    string topic = _params["topic"];
     int port = _params["broker_port"];
 
     lib_init();
     reinitialise("MQTT2MADS-bridge", true);
-    connect(host.c_str(), port, 60);
-    subscribe(NULL, topic.c_str(), 0);
+    _initialized = true;
 
-    // Connect to MQTT
-    _connected = true;
+    // Connect to MQTT; subscription happens in on_connect()
+    int rc = connect(host.c_str(), port, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+      _error = mosqpp::strerror(rc);
+      schedule_reconnect();
+    }
     return status;
   }
 
@@ -59,26 +87,178 @@ public:
     mosqpp::lib_cleanup();
   }
 
-  // void on_connect(int rc) override {
-  //   cout << "Connected with code " << rc << endl;
-  //   return;
-  // }
+  // Subscribing here means that subscriptions are renewed after every
+  // reconnection
+  void on_connect(int rc) override {
+    if (rc != 0) {
+      _error = mosqpp::connack_string(rc);
+      _connected = false;
+      schedule_reconnect();
+      return;
+    }
+    for (auto &sub : _subscriptions) {
+      subscribe(NULL, sub.filter.c_str(), sub.qos);
+    }
+    _connected = true;
+    _backoff = _reconnect_delay;
+  }
+
+  void on_disconnect(int rc) override {
+    _connected = false;
+    if (rc != 0) schedule_reconnect();
+  }
+
+  // Exponential backoff: the delay between attempts doubles at each failure,
+  // up to reconnect_delay_max, and is reset on successful connection
+  void schedule_reconnect() {
+    _connected = false;
+    _next_attempt = chrono::steady_clock::now() + _backoff;
+    _backoff = min(_backoff * 2, _reconnect_delay_max);
+  }
+
+  // Tries to reconnect when the backoff period has expired, otherwise waits
+  // for a while, so that the agent does not spin while disconnected
+  void try_reconnect() {
+    auto now = chrono::steady_clock::now();
+    if (now < _next_attempt) {
+      this_thread::sleep_for(min<chrono::steady_clock::duration>(
+        _next_attempt - now, chrono::milliseconds(100)));
+      return;
+    }
+    int rc = reconnect();
+    if (rc != MOSQ_ERR_SUCCESS) {
+      _error = mosqpp::strerror(rc);
+      schedule_reconnect();
+    } else {
+      // on_connect() is called from within loop() upon CONNACK
+      _next_attempt = now + _backoff;
+    }
+  }
 	
+  // Guess the encoding of a payload from its first bytes. Returns "json",
+  // "cbor", "msgpack", "ambiguous" (may be either CBOR or MessagePack), 
+  // "text" (may be a JSON scalar) or "binary".
+  static string detect_format(const uint8_t *begin, const uint8_t *end) {
+    const uint8_t *p = begin;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    if (p == end) return "binary";
+    uint8_t c = *p;
+    if (c == '{' || c == '[' || c == '"') return "json";
+    // CBOR self-described (tag 55799) or map
+    if (end - p >= 3 && p[0] == 0xd9 && p[1] == 0xd9 && p[2] == 0xf7) 
+      return "cbor";
+    if (c >= 0xa0 && c <= 0xbf) return "cbor";
+    // MessagePack map16/map32/array16/array32
+    if (c >= 0xdc && c <= 0xdf) return "msgpack";
+    // MessagePack fixmap/fixarray overlap with CBOR arrays
+    if (c >= 0x80 && c <= 0x9f) return "ambiguous";
+    if (c >= 0x20 && c < 0x7f) return "text";
+    return "binary";
+  }
+
+  // Messages are queued: when get_output() is called less often than
+  // messages arrive, they are not lost but returned in order (and possibly in
+  // batches, see get_output()). The oldest messages are dropped when the
+  // queue exceeds the `queue_capa` parameter.
+  // Payloads are decoded straight from the mosquitto buffer, honoring 
+  // payloadlen. Payloads that cannot be decoded into JSON are forwarded
+  // untouched as blobs.
+  // Topics are matched against the subscription table first, so that 
+  // messages not matching any subscription are dropped before decoding.
   void on_message(const struct mosquitto_message *message) override {
-    _data.clear();
-    try {
-      _data = json::parse((char *)(message->payload));
-      _error = "No error";
-    } catch (json::parse_error &e) {
-      _error = e.what();
-      _data["error"] = "Error parsing invalid JSON received from MQTT";
-      _data["reason"] = _error;
-      _data["content"] = (char *)(message->payload);
+    _matches.clear();
+    _router.match(message->topic, [this](size_t i) { _matches.push_back(i); });
+    if (_matches.empty()) {
+      _unmatched++;
+      return;
+    }
+    // Overlapping filters of the same subscription deliver only once
+    sort(_matches.begin(), _matches.end());
+    _matches.erase(unique(_matches.begin(), _matches.end()), _matches.end());
+
+    Message msg{message->topic, json{}, {}, "none", true, ""};
+    auto begin = static_cast<const uint8_t *>(message->payload);
+    auto end = begin + message->payloadlen;
+    string format = _binary_format == "auto" ? detect_format(begin, end) : _binary_format;
+    if (format == "json") {
+      try {
+        msg.data = json::parse(begin, end);
+      } catch (json::parse_error &e) {
+        msg.valid = false;
+        msg.data["error"] = "Error parsing invalid JSON received from MQTT";
+        msg.data["reason"] = e.what();
+        msg.data["size"] = message->payloadlen;
+        msg.blob_format = "text";
+      }
+    } else if (format == "text") {
+      msg.data = json::parse(begin, end, nullptr, false);
+      if (msg.data.is_discarded()) msg.blob_format = "text";
+    } else if (_decode_binary && (format == "msgpack" || format == "ambiguous")) {
+      msg.data = json::from_msgpack(begin, end, true, false);
+      if (msg.data.is_discarded() && format == "ambiguous") format = "cbor";
+      else if (msg.data.is_discarded()) msg.blob_format = "msgpack";
+    } 
+    if (_decode_binary && format == "cbor") {
+      msg.data = json::from_cbor(begin, end, true, false);
+      if (msg.data.is_discarded()) msg.blob_format = "cbor";
+    } else if (!_decode_binary && format != "json" && format != "text") {
+      msg.blob_format = format == "ambiguous" ? "binary" : format;
+    } else if (format == "binary") {
+      msg.blob_format = "binary";
+    }
+    if (msg.blob_format != "none") {
+      if (msg.valid) msg.data = {{"size", message->payloadlen}};
+      msg.blob.assign(begin, end);
+    }
+    for (size_t i = 0; i < _matches.size(); i++) {
+      const Subscription &sub = _subscriptions[_matches[i]];
+      Message m = (i + 1 == _matches.size()) ? move(msg) : msg;
+      if (!sub.topic.empty()) {
+        m.mqtt_topic = move(m.topic);
+        m.topic = sub.topic;
+      }
+      if (!sub.fields.empty() && m.valid && m.blob.empty()) {
+        json projected = json::object();
+        for (auto &[name, ptr] : sub.fields) {
+          if (m.data.contains(ptr)) projected[name] = move(m.data[ptr]);
+        }
+        m.data = move(projected);
+      }
+      _queue.push_back(move(m));
+      if (_queue.size() > _queue_capa) {
+        _queue.pop_front();
+        _dropped++;
+      }
     }
-    _topic = message->topic;
     return;
   }
 
+  // Builds the subscription table and its trie from the `subscriptions`
+  // parameter, or from the `topic` parameter if the former is missing
+  void set_subscriptions() {
+    json subs = _params.value("subscriptions", json::array());
+    if (subs.empty() && _params.contains("topic")) {
+      subs.push_back({{"filter", _params["topic"]}});
+    }
+    _subscriptions.clear();
+    _router = TopicTrie<size_t>();
+    for (auto &s : subs) {
+      Subscription sub{s.value("filter", "#"), s.value("topic", ""), s.value("qos", 0), {}};
+      json fields = s.value("fields", json::array());
+      if (fields.is_object()) {
+        for (auto &[name, ptr] : fields.items())
+          sub.fields.emplace_back(name, json::json_pointer(ptr.get<string>()));
+      } else {
+        for (auto &ptr : fields) {
+          json::json_pointer p(ptr.get<string>());
+          sub.fields.emplace_back(p.empty() ? "" : p.back(), p);
+        }
+      }
+      _router.insert(sub.filter, _subscriptions.size());
+      _subscriptions.push_back(move(sub));
+    }
+  }
+
 
 /*
   ____  _    _   _  ____ ___ _   _ 
@@ -88,45 +268,133 @@ public:
  |_|   |_____\___/ \____|___|_| \_|
                                    
 */
+  // With batch_size = 1 (default), each call returns a single message as
+  // {"payload": ..., "topic": ...}.
+  // With batch_size > 1, each call drains up to batch_size queued messages,
+  // waiting at most batch_delay ms for the batch to fill up, and returns them
+  // as {"batch": [{"payload": ..., "topic": ...}, ...], "count": n}.
+  // Messages carrying a blob (non-JSON payload) are always returned alone, 
+  // with the raw payload in blob and its format in blob_format().
   return_type get_output(json &out, std::vector<unsigned char> *blob = nullptr) override {
     if (setup() != return_type::success) {
       return return_type::critical;
     }
-    loop();
-    if(_data.is_null() || _data.empty()) {
-      _data.clear();
+    // Do not block on the network if there are already messages to deliver
+    int rc = loop(_queue.empty() ? -1 : 0);
+    if (_batch_size > 1) {
+      auto deadline = chrono::steady_clock::now() + _batch_delay;
+      while (_queue.size() < _batch_size && rc == MOSQ_ERR_SUCCESS) {
+        auto remaining = chrono::duration_cast<chrono::milliseconds>(
+          deadline - chrono::steady_clock::now()).count();
+        if (remaining <= 0) break;
+        rc = loop(static_cast<int>(remaining));
+      }
+    }
+    if (rc == MOSQ_ERR_NO_CONN || rc == MOSQ_ERR_CONN_LOST) {
+      if (_connected) schedule_reconnect();
+      try_reconnect();
+    }
+    if (_queue.empty()) {
       return return_type::retry;
     }
     out.clear();
-    out["payload"] = _data;
-    out["topic"] = _topic;
+    _blob_format = "none";
+    if (blob) blob->clear();
+    if (_batch_size <= 1 || !_queue.front().blob.empty()) {
+      Message &msg = _queue.front();
+      out["payload"] = move(msg.data);
+      out["topic"] = move(msg.topic);
+      if (!msg.mqtt_topic.empty()) out["mqtt_topic"] = move(msg.mqtt_topic);
+      if (!msg.blob.empty()) {
+        _blob_format = msg.blob_format;
+        if (blob) blob->swap(msg.blob);
+      }
+      bool valid = msg.valid;
+      _queue.pop_front();
+      if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+      if (_batch_size <= 1) this_thread::sleep_for(chrono::microseconds(500));
+      if (!valid) {
+        _error = out["payload"]["reason"];
+        return return_type::error;
+      }
+      _error = "No error";
+      return return_type::success;
+    }
+    size_t n = 0;
+    size_t invalid = 0;
+    json &batch = out["batch"] = json::array();
+    for (; n < _batch_size && !_queue.empty(); n++) {
+      Message &msg = _queue.front();
+      if (!msg.blob.empty()) break;
+      if (!msg.valid) {
+        _error = msg.data["reason"];
+        invalid++;
+      }
+      batch.push_back({{"payload", move(msg.data)}, {"topic", move(msg.topic)}});
+      if (!msg.mqtt_topic.empty()) batch.back()["mqtt_topic"] = move(msg.mqtt_topic);
+      _queue.pop_front();
+    }
+    out["count"] = n;
     if (!_agent_id.empty()) out["agent_id"] = _agent_id;
-    _data.clear();
-    this_thread::sleep_for(chrono::microseconds(500));
-    if (_error != "No error") 
+    if (invalid == n) 
       return return_type::error;
-    else
-      return return_type::success;
+    else if (invalid > 0)
+      return return_type::warning;
+    _error = "No error";
+    return return_type::success;
   }
 
   void set_params(const json &params) override { 
     Source::set_params(params);
     _params["broker_host"] = "localhost";
     _params["broker_port"] = 1883;
+    _params["batch_size"] = 1;     // max number of messages per get_output()
+    _params["batch_delay"] = 10;   // max time (ms) spent filling a batch
+    _params["queue_capa"] = 10000; // max number of queued messages
+    _params["binary_format"] = "auto"; // auto, json, cbor, msgpack, binary
+    _params["decode_binary"] = true;   // decode CBOR/MessagePack into JSON
+    _params["reconnect_delay"] = 500;       // ms, first reconnection delay
+    _params["reconnect_delay_max"] = 30000; // ms, max reconnection delay
     _params.merge_patch(params);
+    _reconnect_delay = chrono::milliseconds(_params["reconnect_delay"].get<long long>());
+    _reconnect_delay_max = chrono::milliseconds(_params["reconnect_delay_max"].get<long long>());
+    _backoff = _reconnect_delay;
+    _binary_format = _params["binary_format"];
+    _decode_binary = _params["decode_binary"];
+    set_subscriptions();
+    _batch_size = max<size_t>(1, _params["batch_size"].get<size_t>());
+    _batch_delay = chrono::milliseconds(_params["batch_delay"].get<long long>());
+    _queue_capa = max<size_t>(1, _params["queue_capa"].get<size_t>());
   }
 
   map<string, string> info() override {
     return {
       {"Broker:", _params["broker_host"].get<string>() + ":" + to_string(_params["broker_port"])},
-      {"Topic:", _params["topic"]}
+      {"Topic:", _subscriptions.size() == 1 ? _subscriptions[0].filter : to_string(_subscriptions.size()) + " subscriptions"},
+      {"Batch:", to_string(_batch_size) + " msgs / " + to_string(_batch_delay.count()) + " ms"},
+      {"Connected:", _connected ? "yes" : "no"},
+      {"Dropped:", to_string(_dropped) + " (unmatched " + to_string(_unmatched) + ")"}
     };
   };
 
 private:
-  json _data, _params;
-  string _topic;
+  json _params;
+  deque<Message> _queue;
+  size_t _batch_size = 1;
+  size_t _queue_capa = 10000;
+  size_t _dropped = 0;
+  size_t _unmatched = 0;
+  vector<Subscription> _subscriptions;
+  TopicTrie<size_t> _router;
+  vector<size_t> _matches;
+  chrono::milliseconds _batch_delay{10};
+  string _binary_format = "auto";
+  bool _decode_binary = true;
+  bool _initialized = false;
   bool _connected = false;
+  chrono::milliseconds _reconnect_delay{500}, _reconnect_delay_max{30000};
+  chrono::milliseconds _backoff{500};
+  chrono::steady_clock::time_point _next_attempt;
 };
 
 
@@ -156,14 +424,20 @@ int main(int argc, char const *argv[]) {
   params["broker_host"] = "localhost";
   params["broker_port"] = 1883;
   params["topic"] = "capture/#";
+  if (argc > 1) params["batch_size"] = atoi(argv[1]);
 
   // Set parameters
   bridge.set_params(params);
 
   // Process data
+  vector<unsigned char> blob;
   while (true) {
-    if (bridge.get_output(output) == return_type::success) 
-      cout << "MQTT: " << output << endl;
+    if (bridge.get_output(output, &blob) == return_type::success) {
+      cout << "MQTT: " << output;
+      if (bridge.blob_format() != "none")
+        cout << " + " << blob.size() << " bytes of " << bridge.blob_format();
+      cout << endl;
+    }
   }
   
   return 0;
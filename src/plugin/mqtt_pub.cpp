@@ -0,0 +1,543 @@
+/*
+  __  __  ___ _____ _____   ____        _     _ _     _
+ |  \/  |/ _ \_   _|_   _| |  _ \ _   _| |__ | (_)___| |__   ___ _ __
+ | |\/| | | | || |   | |   | |_) | | | | '_ \| | / __| '_ \ / _ \ '__|
+ | |  | | |_| || |   | |   |  __/| |_| | |_) | | \__ \ | | |  __/ |
+ |_|  |_|\__\_\|_|   |_|   |_|    \__,_|_.__/|_|_|___/_| |_|\___|_|
+
+Publishes MADS messages to a MQTT network
+*/
+
+#include "../sink.hpp"
+#include "../histogram.hpp"
+#include "../spool.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <mosquittopp.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "mqtt_pub"
+#endif
+
+using namespace std;
+using namespace mosqpp;
+using json = nlohmann::json;
+using steady = chrono::steady_clock;
+
+
+class MQTTPublisher : public Sink<json>, public mosquittopp {
+
+  // A message waiting to be published
+  struct Pending {
+    string topic;
+    string payload;
+    steady::time_point queued;
+  };
+
+  // A piece of the topic template: either a literal string or a field
+  // reference (dotted path in the message, or the MADS topic)
+  struct TopicPart {
+    string text;
+    bool field;
+  };
+
+public:
+  string kind() override { return PLUGIN_NAME; }
+
+  ~MQTTPublisher() {
+    if (_running) {
+      flush(_linger);
+      {
+        // take both locks, so that no thread misses the notification
+        scoped_lock lk(_mtx, _ack_mtx);
+        _stop = true;
+      }
+      _queue_cv.notify_all();
+      _ack_cv.notify_all();
+      _publisher.join();
+      disconnect();
+      loop_stop();
+    }
+    mosqpp::lib_cleanup();
+  }
+
+/*
+  __  __  ___ _____ _____            _       _           _
+ |  \/  |/ _ \_   _|_   _|  _ __ ___| | __ _| |_ ___  __| |
+ | |\/| | | | || |   | |   | '__/ _ \ |/ _` | __/ _ \/ _` |
+ | |  | | |_| || |   | |   | | |  __/ | (_| | ||  __/ (_| |
+ |_|  |_|\__\_\|_|   |_|   |_|  \___|_|\__,_|\__\___|\__,_|
+
+*/
+
+  // Connects asynchronously and starts the mosquitto network thread, which
+  // also takes care of reconnecting with exponential backoff, and the 
+  // publisher thread
+  return_type setup() {
+    if (_running) return return_type::success;
+    string host = _params["broker_host"];
+    int port = _params["broker_port"];
+    string client_id = _params["client_id"];
+
+    if (!_params["spool_dir"].get<string>().empty()) {
+      try {
+        _spool = make_unique<Spool>(
+          _params["spool_dir"].get<string>(),
+          _params["spool_segment"].get<size_t>() * 1024 * 1024,
+          _params["spool_max_size"].get<size_t>() * 1024 * 1024);
+      } catch (std::exception &e) {
+        _error = e.what();
+        return return_type::critical;
+      }
+    }
+
+    lib_init();
+    reinitialise(client_id.c_str(), true);
+    max_inflight_messages_set(_qos > 0 ? _window : 0);
+    // mosquitto wants seconds
+    reconnect_delay_set(max(1u, _params["reconnect_delay"].get<unsigned>() / 1000),
+                        max(1u, _params["reconnect_delay_max"].get<unsigned>() / 1000),
+                        true);
+    int rc = connect_async(host.c_str(), port, 60);
+    if (rc != MOSQ_ERR_SUCCESS) {
+      _error = mosqpp::strerror(rc);
+      return return_type::critical;
+    }
+    loop_start();
+    _running = true;
+    _publisher = thread(&MQTTPublisher::publisher_loop, this);
+    return return_type::success;
+  }
+
+  void on_connect(int rc) override {
+    {
+      lock_guard<mutex> lk(_mtx);
+      _connected = (rc == 0);
+      if (rc != 0) _async_error = mosqpp::connack_string(rc);
+    }
+    _queue_cv.notify_all();
+  }
+
+  void on_disconnect(int rc) override {
+    lock_guard<mutex> lk(_mtx);
+    _connected = false;
+  }
+
+  // Called when a QoS 0 message has been sent, or when the PUBACK (QoS 1) or
+  // PUBCOMP (QoS 2) has been received
+  void on_publish(int mid) override {
+    {
+      lock_guard<mutex> lk(_ack_mtx);
+      auto it = _sent.find(mid);
+      if (it == _sent.end()) return;
+      chrono::duration<double, micro> dt = steady::now() - it->second;
+      _ack_latency.add(dt.count());
+      _sent.erase(it);
+      _acked++;
+    }
+    _ack_cv.notify_all();
+  }
+
+  // Takes messages from the queue, a batch at a time, and publishes them
+  // while keeping at most max_inflight messages waiting for acknowledge.
+  // With a spool, messages are stored on disk while disconnected, and as 
+  // long as the spool is not empty, so that they are published in order.
+  // A message that publish_one() could not hand to the library (QoS 0 ones,
+  // when the connection drops) is spooled too.
+  void publisher_loop() {
+    vector<Pending> batch;
+    batch.reserve(_max_batch);
+    while (true) {
+      bool connected;
+      {
+        unique_lock<mutex> lk(_mtx);
+        _queue_cv.wait(lk, [&] {
+          return _stop || (_connected && (!_queue.empty() || spooling())) ||
+                 (_spool && !_queue.empty());
+        });
+        if (_stop) break;
+        connected = _connected;
+        while (!_queue.empty() && batch.size() < _max_batch) {
+          if (_coalesce) _latest.erase(_queue.front().topic);
+          batch.push_back(move(_queue.front()));
+          _queue.pop_front();
+        }
+      }
+      if (_spool && (!connected || spooling())) {
+        for (auto &m : batch) {
+          if (!_spool->push(m.topic, m.payload)) _failed++;
+        }
+        batch.clear();
+        if (connected) replay();
+        continue;
+      }
+      for (auto &m : batch) {
+        if (publish_one(m) == MOSQ_ERR_NO_CONN && _spool) {
+          if (!_spool->push(m.topic, m.payload)) _failed++;
+        }
+      }
+      batch.clear();
+    }
+  }
+
+  bool spooling() { return _spool && !_spool->empty(); }
+
+  // Publishes up to max_batch messages from the spool, at most catchup_rate
+  // messages per second. Messages are removed from the spool only when
+  // handed to the mosquitto library, which then takes care of delivering 
+  // them even across reconnections.
+  void replay() {
+    Pending m;
+    for (size_t i = 0; i < _max_batch && !_stop && _spool->front(m.topic, m.payload); i++) {
+      if (_catchup_rate > 0) {
+        auto now = steady::now();
+        if (_next_replay > now) this_thread::sleep_until(_next_replay);
+        _next_replay = max(_next_replay, now) + chrono::duration_cast<steady::duration>(
+          chrono::duration<double>(1.0 / _catchup_rate));
+      }
+      m.queued = steady::now();
+      if (publish_one(m) == MOSQ_ERR_NO_CONN) break;
+      _spool->pop();
+      _replayed++;
+    }
+  }
+
+  int publish_one(const Pending &m) {
+    chrono::duration<double, micro> dt = steady::now() - m.queued;
+    unique_lock<mutex> ak(_ack_mtx);
+    _queue_latency.add(dt.count());
+    if (_qos > 0) {
+      _ack_cv.wait(ak, [&] { return _stop || _sent.size() < _window; });
+      if (_stop) return MOSQ_ERR_NO_CONN;
+    }
+    int mid = 0;
+    int rc = publish(&mid, m.topic.c_str(), static_cast<int>(m.payload.size()),
+                     m.payload.data(), _qos, _retain);
+    // with QoS > 0, the library keeps a message it cannot send for lack of
+    // connection, and sends it on reconnection: it is handed off, and must
+    // not be spooled too
+    if (rc == MOSQ_ERR_NO_CONN && _qos > 0 && mid != 0) rc = MOSQ_ERR_SUCCESS;
+    if (rc == MOSQ_ERR_SUCCESS) {
+      _sent[mid] = steady::now();
+      _published++;
+    } else if (rc != MOSQ_ERR_NO_CONN) {
+      _failed++;
+      ak.unlock();
+      lock_guard<mutex> lk(_mtx);
+      _async_error = mosqpp::strerror(rc);
+    }
+    return rc;
+  }
+
+  // Splits the topic template into literal and field parts
+  void compile_topic(const string &tmpl) {
+    _topic_parts.clear();
+    size_t pos = 0;
+    while (pos < tmpl.size()) {
+      size_t open = tmpl.find('{', pos);
+      size_t close = open == string::npos ? string::npos : tmpl.find('}', open);
+      if (close == string::npos) {
+        _topic_parts.push_back({tmpl.substr(pos), false});
+        break;
+      }
+      if (open > pos) _topic_parts.push_back({tmpl.substr(pos, open - pos), false});
+      _topic_parts.push_back({tmpl.substr(open + 1, close - open - 1), true});
+      pos = close + 1;
+    }
+  }
+
+  // Renders the topic template: {topic} is replaced by the MADS topic, 
+  // {agent_id} by the agent id, any other {a.b.c} by the value of the field
+  // data["a"]["b"]["c"]. Wildcard
+  // characters are not allowed in published topics, so they are replaced.
+  string render_topic(const json &data, const string &topic) const {
+    string result;
+    for (auto &part : _topic_parts) {
+      if (!part.field) {
+        result += part.text;
+        continue;
+      }
+      if (part.text == "topic") {
+        result += topic;
+        continue;
+      } else if (part.text == "agent_id" && !_agent_id.empty()) {
+        result += _agent_id;
+        continue;
+      }
+      const json *node = &data;
+      size_t pos = 0;
+      while (node && pos <= part.text.size()) {
+        size_t dot = part.text.find('.', pos);
+        string key = part.text.substr(pos, dot == string::npos ? string::npos : dot - pos);
+        node = (node->is_object() && node->contains(key)) ? &(*node)[key] : nullptr;
+        if (dot == string::npos) break;
+        pos = dot + 1;
+      }
+      if (!node)
+        result += "_";
+      else if (node->is_string())
+        result += node->get<string>();
+      else
+        result += node->dump();
+    }
+    for (auto &c : result) {
+      if (c == '+' || c == '#') c = '_';
+    }
+    return result;
+  }
+
+  string serialize(const json &data) const {
+    if (_format == "msgpack") {
+      auto v = json::to_msgpack(data);
+      return string(v.begin(), v.end());
+    } else if (_format == "cbor") {
+      auto v = json::to_cbor(data);
+      return string(v.begin(), v.end());
+    }
+    return data.dump();
+  }
+
+  /*!
+   * Waits until all queued messages have been published and acknowledged,
+   * or the timeout expires. Returns true if everything has been delivered.
+   */
+  bool flush(chrono::milliseconds timeout) {
+    auto deadline = steady::now() + timeout;
+    {
+      unique_lock<mutex> lk(_mtx);
+      while (!_queue.empty()) {
+        lk.unlock();
+        if (steady::now() > deadline) return false;
+        this_thread::sleep_for(chrono::milliseconds(1));
+        lk.lock();
+      }
+    }
+    unique_lock<mutex> ak(_ack_mtx);
+    return _ack_cv.wait_until(ak, deadline, [&] { return _sent.empty(); });
+  }
+
+
+/*
+  ____  _    _   _  ____ ___ _   _
+ |  _ \| |  | | | |/ ___|_ _| \ | |
+ | |_) | |  | | | | |  _ | ||  \| |
+ |  __/| |__| |_| | |_| || || |\  |
+ |_|   |_____\___/ \____|___|_| \_|
+
+*/
+  // Only renders the topic and serializes the payload: the actual publishing
+  // happens on the publisher thread, so this never blocks on the network
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    if (setup() != return_type::success) {
+      return return_type::critical;
+    }
+    Pending msg{render_topic(d, topic), "", steady::now()};
+    if (_payload_field.empty()) {
+      msg.payload = serialize(d);
+    } else if (d.contains(_payload_field)) {
+      msg.payload = serialize(d[_payload_field]);
+    } else {
+      _error = "Missing field " + _payload_field;
+      return return_type::warning;
+    }
+    bool async_failed = false;
+    {
+      lock_guard<mutex> lk(_mtx);
+      // errors of the background threads are reported here, in the host
+      // thread, as error() is not synchronized
+      if (!_async_error.empty()) {
+        _error = move(_async_error);
+        _async_error.clear();
+        async_failed = true;
+      }
+      if (_coalesce) {
+        auto it = _latest.find(msg.topic);
+        if (it != _latest.end()) {
+          it->second->payload = move(msg.payload);
+          _coalesced++;
+          return async_failed ? return_type::warning : return_type::success;
+        }
+      }
+      if (_queue.size() >= _queue_capa) {
+        if (_coalesce) _latest.erase(_queue.front().topic);
+        _queue.pop_front();
+        _dropped++;
+      }
+      _queue.push_back(move(msg));
+      if (_coalesce) _latest[_queue.back().topic] = prev(_queue.end());
+    }
+    _queue_cv.notify_one();
+    return async_failed ? return_type::warning : return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["broker_host"] = "localhost";
+    _params["broker_port"] = 1883;
+    _params["client_id"] = "MADS2MQTT-bridge";
+    _params["topic"] = "mads/{topic}"; // topic template
+    _params["payload_field"] = "";     // publish only this field, if given
+    _params["format"] = "json";        // json, msgpack or cbor
+    _params["qos"] = 1;
+    _params["retain"] = false;
+    _params["max_inflight"] = 20;      // QoS > 0 messages waiting for ack
+    _params["max_batch"] = 64;         // messages taken from queue at once
+    _params["coalesce"] = false;       // only keep latest message per topic
+    _params["queue_capa"] = 10000;     // max queued messages
+    _params["linger"] = 1000;          // ms to wait for delivery at exit
+    _params["reconnect_delay"] = 1000;      // ms, first reconnection delay
+    _params["reconnect_delay_max"] = 30000; // ms, max reconnection delay
+    _params["spool_dir"] = "";         // if given, spool to disk when offline
+    _params["spool_segment"] = 16;     // MB, size of spool segment files
+    _params["spool_max_size"] = 1024;  // MB, max disk usage of the spool
+    _params["catchup_rate"] = 1000;    // msg/s replayed from spool, 0: max
+    _params.merge_patch(params);
+    compile_topic(_params["topic"]);
+    _payload_field = _params["payload_field"];
+    _format = _params["format"];
+    _qos = clamp(_params["qos"].get<int>(), 0, 2);
+    _retain = _params["retain"];
+    _window = max<size_t>(1, _params["max_inflight"].get<size_t>());
+    _max_batch = max<size_t>(1, _params["max_batch"].get<size_t>());
+    _coalesce = _params["coalesce"];
+    _queue_capa = max<size_t>(1, _params["queue_capa"].get<size_t>());
+    _linger = chrono::milliseconds(_params["linger"].get<long long>());
+    _catchup_rate = _params["catchup_rate"];
+  }
+
+  map<string, string> info() override {
+    lock_guard<mutex> lk(_ack_mtx);
+    return {
+      {"Broker:", _params["broker_host"].get<string>() + ":" + to_string(_params["broker_port"])},
+      {"Topic:", _params["topic"]},
+      {"QoS:", to_string(_qos) + " (window " + to_string(_window) + ")"},
+      {"Published:", to_string(_published) + " (acked " + to_string(_acked) +
+                     ", dropped " + to_string(_dropped) +
+                     ", coalesced " + to_string(_coalesced) + ")"},
+      {"Ack latency (us):", _ack_latency.summary().dump()},
+      {"Spool:", _params["spool_dir"].get<string>().empty() ? "disabled" : _params["spool_dir"].get<string>()}
+    };
+  };
+
+  /*!
+   * Returns the publishing statistics, latencies in microseconds
+   */
+  json stats() {
+    lock_guard<mutex> lk(_ack_mtx);
+    return {
+      {"published", _published.load()},
+      {"acked", _acked.load()},
+      {"failed", _failed.load()},
+      {"dropped", _dropped.load()},
+      {"coalesced", _coalesced.load()},
+      {"replayed", _replayed.load()},
+      {"queue_latency", _queue_latency.summary()},
+      {"ack_latency", _ack_latency.summary()}
+    };
+  }
+
+private:
+  json _params;
+  vector<TopicPart> _topic_parts;
+  string _payload_field;
+  string _format = "json";
+  int _qos = 1;
+  bool _retain = false;
+  size_t _window = 20;
+  size_t _max_batch = 64;
+  bool _coalesce = false;
+  size_t _queue_capa = 10000;
+  chrono::milliseconds _linger{1000};
+  double _catchup_rate = 1000;
+
+  // Disk spool, only accessed by the publisher thread
+  unique_ptr<Spool> _spool;
+  steady::time_point _next_replay;
+
+  // Queue of messages to be published, protected by _mtx
+  mutex _mtx;
+  condition_variable _queue_cv;
+  list<Pending> _queue;
+  unordered_map<string, list<Pending>::iterator> _latest;
+  bool _connected = false;
+  string _async_error; // set by the background threads, moved to _error by load_data()
+  atomic<bool> _stop = false;
+
+  // Messages waiting for acknowledge and statistics, protected by _ack_mtx
+  mutex _ack_mtx;
+  condition_variable _ack_cv;
+  unordered_map<int, steady::time_point> _sent;
+  Histogram _queue_latency, _ack_latency;
+  atomic<size_t> _published = 0, _acked = 0, _failed = 0, _dropped = 0, _coalesced = 0;
+  atomic<size_t> _replayed = 0;
+
+  thread _publisher;
+  bool _running = false;
+};
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(MQTTPublisher, json)
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin: publishes a burst
+of messages to a local broker and reports throughput and ack latency
+*/
+int main(int argc, char const *argv[]) {
+  MQTTPublisher publisher;
+  json params;
+  size_t n = argc > 1 ? atol(argv[1]) : 10000;
+  params["broker_host"] = "localhost";
+  params["broker_port"] = 1883;
+  params["topic"] = "mads/bench/{topic}";
+  params["qos"] = argc > 2 ? atoi(argv[2]) : 1;
+  params["max_inflight"] = argc > 3 ? atoi(argv[3]) : 20;
+  params["queue_capa"] = n;
+
+  // Set parameters
+  publisher.set_params(params);
+  for (auto &[k, v] : publisher.info()) {
+    cout << k << " " << v << endl;
+  }
+
+  // Publish a burst of messages
+  json data = {{"data", {{"AX", 1}, {"AY", 2}, {"AZ", 3}}}};
+  auto start = steady::now();
+  for (size_t i = 0; i < n; i++) {
+    data["seq"] = i;
+    if (publisher.load_data(data, "test") != return_type::success) {
+      cerr << "Error: " << publisher.error() << endl;
+      return 1;
+    }
+  }
+  bool delivered = publisher.flush(chrono::seconds(60));
+  chrono::duration<double> elapsed = steady::now() - start;
+
+  cout << "Published " << n << " messages in " << elapsed.count() << " s: "
+       << n / elapsed.count() << " msg/s" << (delivered ? "" : " (incomplete)")
+       << endl;
+  cout << "Stats: " << publisher.stats().dump(2) << endl;
+  return 0;
+}
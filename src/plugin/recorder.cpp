@@ -0,0 +1,137 @@
+/*
+  ____                        _
+ |  _ \ ___  ___ ___  _ __ __| | ___ _ __
+ | |_) / _ \/ __/ _ \| '__/ _` |/ _ \ '__|
+ |  _ <  __/ (_| (_) | | | (_| |  __/ |
+ |_| \_\___|\___\___/|_|  \__,_|\___|_|
+
+Records MADS messages and blobs into a memory-mapped log, for later replay
+*/
+
+#include "../sink.hpp"
+#include "../record_log.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <chrono>
+#include <memory>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "recorder"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// Each message is appended to the log in `dir` with its receive time
+// (system clock, ns), its topic, the data encoded as MessagePack, and the
+// blob, if any. Use the `replay` source to play it back.
+class Recorder : public Sink<json> {
+public:
+  ~Recorder() { if (_log) _log->flush(true); }
+
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    if (!_log) {
+      _error = "Log not open";
+      return return_type::error;
+    }
+    int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    _buffer.clear();
+    json::to_msgpack(d, _buffer);
+    string data(_buffer.begin(), _buffer.end());
+    bool with_blob = blob && !blob->empty();
+    if (!_log->append(now, topic, data, with_blob ? blob->data() : nullptr,
+                      with_blob ? blob->size() : 0, with_blob ? _blob_format : "")) {
+      _error = "Message larger than a log segment";
+      return return_type::error;
+    }
+    if (_sync_every > 0 && _log->records() % _sync_every == 0) _log->flush(true);
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["dir"] = "recording";
+    _params["segment_size"] = 64;   // MB
+    _params["blob_format"] = "binary";
+    _params["sync_every"] = 0;      // records between syncs to disk, 0 for none
+    _params.merge_patch(params);
+    _blob_format = _params["blob_format"];
+    _sync_every = _params["sync_every"];
+    _log.reset();
+    try {
+      _log = make_unique<RecordLog::Writer>(_params["dir"].get<string>(),
+                                            _params["segment_size"].get<size_t>() << 20);
+    } catch (exception &e) {
+      _error = e.what();
+      cerr << "recorder: " << _error << endl;
+    }
+  }
+
+  map<string, string> info() override {
+    return {
+      {"dir", _params["dir"]},
+      {"segment_size", to_string(_params["segment_size"].get<size_t>()) + " MB"},
+      {"records", to_string(_log ? _log->records() : 0)},
+      {"bytes", to_string(_log ? _log->bytes() : 0)},
+      {"segment", to_string(_log ? _log->segment() : 0)}
+    };
+  };
+
+private:
+  json _params;
+  unique_ptr<RecordLog::Writer> _log;
+  vector<uint8_t> _buffer;
+  string _blob_format;
+  size_t _sync_every = 0;
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(Recorder, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+#include <thread>
+int main(int argc, char const *argv[]) {
+  // recorder [n] [dir]: records n messages, one per ms
+  size_t n = argc > 1 ? atoi(argv[1]) : 1000;
+  Recorder recorder;
+  recorder.set_params({
+    {"dir", argc > 2 ? argv[2] : (filesystem::temp_directory_path() / "recording").string()},
+    {"segment_size", 1}
+  });
+  vector<unsigned char> blob(100, 0xAB);
+  for (size_t i = 0; i < n; i++) {
+    json data = {{"i", i}, {"data", {{"x", 0.5 * i}}}};
+    recorder.load_data(data, "test", i % 10 == 0 ? &blob : nullptr);
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  for (auto &[k, v] : recorder.info()) cout << k << ": " << v << endl;
+  return 0;
+}
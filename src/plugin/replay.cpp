@@ -0,0 +1,211 @@
+/*
+  ____            _
+ |  _ \ ___ _ __ | | __ _ _   _
+ | |_) / _ \ '_ \| |/ _` | | | |
+ |  _ <  __/ |_) | | (_| | |_| |
+ |_| \_\___| .__/|_|\__,_|\__, |
+           |_|            |___/
+Replays a log written by the recorder sink
+*/
+
+#include "../source.hpp"
+#include "../record_log.hpp"
+#include "../ticker.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "replay"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// Messages are played back with the original time intervals divided by
+// `speed` (1 is real time, 0 is as fast as possible), starting from the
+// first record at or after `start`, and until `stop`. The schedule is
+// absolute, so that the replay does not drift when the downstream agents
+// are slow.
+class Replay : public Source<json> {
+public:
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type get_output(json &out, std::vector<unsigned char> *blob = nullptr) override {
+    out.clear();
+    if (!_log) {
+      _error = "Log not open";
+      return return_type::critical;
+    }
+    if (!_log->next(_record) || (_stop > 0 && _record.timestamp > _stop)) {
+      if (!_log->error().empty()) {
+        _error = _log->error();
+        return return_type::critical;
+      }
+      if (!_loop) {
+        _error = "End of recording";
+        return return_type::critical;
+      }
+      rewind();
+      if (!_log->next(_record)) {
+        _error = "Empty recording";
+        return return_type::critical;
+      }
+    }
+
+    // pacing
+    if (_speed > 0) {
+      if (_first < 0) {
+        _first = _record.timestamp;
+        _wall = Ticker::clock::now();
+      }
+      auto offset = chrono::nanoseconds(static_cast<int64_t>((_record.timestamp - _first) / _speed));
+      Ticker::sleep_until(_wall + chrono::duration_cast<Ticker::clock::duration>(offset));
+    }
+
+    out = json::from_msgpack(_record.data.begin(), _record.data.end(), true, false);
+    if (out.is_discarded()) {
+      _error = "Invalid record data";
+      return return_type::error;
+    }
+    if (!_topic_field.empty()) out[_topic_field] = _record.topic;
+    if (_with_timestamp) out["recorded"] = _record.timestamp;
+    _blob_format = "none";
+    if (blob && !_record.blob.empty()) {
+      blob->swap(_record.blob);
+      _blob_format = _record.blob_format;
+    } else if (blob) {
+      blob->clear(); // no stale blob from an earlier message
+    }
+    _played++;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Source::set_params(params);
+    _params["dir"] = "recording";
+    _params["speed"] = 1.0;       // 1 real time, N for N times faster, 0 as fast as possible
+    _params["start"] = 0;         // ns, or ISO 8601 local time, 0 for the beginning
+    _params["stop"] = 0;          // as above, 0 for the end
+    _params["loop"] = false;
+    _params["topic_field"] = "";  // if set, the recorded topic is added in this field
+    _params["with_timestamp"] = false; // add the recording time as "recorded" (ns)
+    _params.merge_patch(params);
+    _speed = _params["speed"];
+    _start = parse_time(_params["start"]);
+    _stop = parse_time(_params["stop"]);
+    _loop = _params["loop"];
+    _topic_field = _params["topic_field"];
+    _with_timestamp = _params["with_timestamp"];
+    _log.reset();
+    try {
+      _log = make_unique<RecordLog::Reader>(_params["dir"].get<string>());
+      rewind();
+    } catch (exception &e) {
+      _error = e.what();
+      cerr << "replay: " << _error << endl;
+    }
+  }
+
+  map<string, string> info() override {
+    return {
+      {"dir", _params["dir"]},
+      {"speed", _speed > 0 ? to_string(_speed) + "x" : "max"},
+      {"start", _params["start"].dump()},
+      {"stop", _params["stop"].dump()},
+      {"loop", _loop ? "yes" : "no"},
+      {"segments", to_string(_log ? _log->segment_count() : 0)},
+      {"played", to_string(_played)}
+    };
+  };
+
+  // Parses a time as ns since the epoch or as ISO 8601 local time
+  // ("2024-01-31T10:20:30", fractional seconds and zone are ignored)
+  static int64_t parse_time(const json &t) {
+    if (t.is_number()) return t.get<int64_t>();
+    if (!t.is_string() || t.get<string>().empty()) return 0;
+    tm local = {};
+    istringstream ss(t.get<string>());
+    ss >> get_time(&local, "%Y-%m-%dT%H:%M:%S");
+    if (ss.fail()) return 0;
+    local.tm_isdst = -1;
+    return static_cast<int64_t>(mktime(&local)) * 1000000000LL;
+  }
+
+private:
+  void rewind() {
+    if (_start > 0) _log->seek(_start); else _log->rewind();
+    _first = -1;
+  }
+
+  json _params;
+  unique_ptr<RecordLog::Reader> _log;
+  RecordLog::Record _record;
+  double _speed = 1;
+  int64_t _start = 0, _stop = 0;
+  bool _loop = false, _with_timestamp = false;
+  string _topic_field;
+  int64_t _first = -1;
+  Ticker::clock::time_point _wall;
+  size_t _played = 0;
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SOURCE_DRIVER(Replay, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+int main(int argc, char const *argv[]) {
+  // replay [dir] [speed] [start]: plays back a recording made with the
+  // recorder executable
+  Replay replay;
+  json params = {
+    {"dir", argc > 1 ? argv[1] : (filesystem::temp_directory_path() / "recording").string()},
+    {"speed", argc > 2 ? atof(argv[2]) : 1.0},
+    {"with_timestamp", true},
+    {"topic_field", "topic"}
+  };
+  if (argc > 3) params["start"] = atoll(argv[3]);
+  replay.set_params(params);
+  json out;
+  vector<unsigned char> blob;
+  auto start = chrono::steady_clock::now();
+  size_t n = 0, blobs = 0;
+  while (replay.get_output(out, &blob) == return_type::success) {
+    if (n++ < 3) cout << "Output: " << out << endl;
+    if (!blob.empty()) blobs++;
+    blob.clear();
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << "Played " << n << " messages (" << blobs << " with blob) in "
+       << elapsed.count() << " s: " << replay.error() << endl;
+  return 0;
+}
@@ -9,6 +9,7 @@
 #include "../filter.hpp"
 #include <pugg/Kernel.h>
 #include <nlohmann/json.hpp>
+#include <algorithm>
 #include <deque>
 #include <map>
 
@@ -74,6 +75,43 @@ public:
     };
   };
 
+  // The queues are checkpointed as MessagePack, so that a restarted agent
+  // resumes with full windows
+  return_type save_state(vector<unsigned char> &state) override {
+    json j = json::object();
+    for (auto &[key, queue] : _queues) j[key] = queue;
+    state = json::to_msgpack({{"queues", j}});
+    return return_type::success;
+  }
+
+  return_type load_state(vector<unsigned char> const &state) override {
+    // validated before use: Checkpointer::restore() does not catch json
+    // exceptions, and the current queues are kept on error
+    json j = json::from_msgpack(state, true, false);
+    bool valid = j.is_object() && j.contains("queues") && j["queues"].is_object();
+    if (valid) {
+      for (auto &[key, values] : j["queues"].items()) {
+        valid = values.is_array() &&
+                all_of(values.begin(), values.end(), [](const json &v) { return v.is_number(); });
+        if (!valid) break;
+      }
+    }
+    if (!valid) {
+      _error = "Invalid state";
+      return return_type::error;
+    }
+    _queues.clear();
+    size_t capa = _params["capa"];
+    for (auto &[key, values] : j["queues"].items()) {
+      auto &queue = _queues[key];
+      for (auto &v : values) {
+        if (queue.size() >= capa) break;
+        queue.push_back(v.get<double>());
+      }
+    }
+    return return_type::success;
+  }
+
 private:
   map<string, deque<double>> _queues;
 };
@@ -147,6 +185,26 @@ int main(int argc, char const *argv[])
   ra.process(output);
   cout << "Output: " << output.dump(2) << endl;
 
+  // warm restart: a new instance resumes from the saved queues
+  vector<unsigned char> state;
+  ra.save_state(state);
+  RunningAverage restarted;
+  restarted.set_params(params);
+  restarted.load_state(state);
+  restarted.process(output);
+  cout << "Restored (" << state.size() << " bytes): " << output << endl;
+
+  // a state of the wrong shape is rejected, and the queues are kept
+  for (json bad : {json::array({1, 2}), json{{"queues", 1}},
+                   json{{"queues", {{"AX", "x"}}}}, json{{"queues", {{"AX", {1, "x"}}}}}}) {
+    if (restarted.load_state(json::to_msgpack(bad)) != return_type::error) {
+      cerr << "Accepted invalid state: " << bad << endl;
+      return 1;
+    }
+  }
+  restarted.process(output);
+  cout << "After invalid states: " << output << endl;
+
 
   return 0;
 }
@@ -9,10 +9,13 @@ A Template for a Source Plugin
 */
 // Mandatory included headers
 #include "../source.hpp"
+#include "../ticker.hpp"
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
-#include <queue>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <random>
 #include <thread>
 #include <uuid/uuid.h>
 
@@ -30,9 +33,18 @@ using json = nlohmann::json;
 
 // Plugin class. This shall be the only part that needs to be modified,
 // implementing the actual functionality
+//
+// Without a `rate`, each message is emitted as soon as get_output() is
+// called. With a `rate` (messages per second), the spawner is an open-loop
+// load generator: every message has an intended send time, taken from the
+// arrival process selected by `mode`, and get_output() sleeps until then.
+// When the pipeline falls behind, the schedule is not moved: messages are
+// sent late, but their `intended` time lets downstream measurements account
+// for the delay (avoiding coordinated omission).
 class SpawnerPlugin : public Source<json> {
 
 public:
+  enum class mode { constant, poisson, bursty, ramp };
 
   // Typically, no need to change this
   string kind() override { return PLUGIN_NAME; }
@@ -41,14 +53,25 @@ public:
   return_type get_output(json &out,
                          std::vector<unsigned char> *blob = nullptr) override {
     out.clear();
-    if (_periods.empty()) {
+    if (_number > 0 && _count >= _number) {
       _error = "No more periods available";
       return return_type::critical;
     }
-    size_t period = _periods.front();
-    _periods.pop();
-    out["data"]["period"] = period;
 
+    // Open-loop pacing: wait for the intended time of this message
+    if (_rate > 0) {
+      if (_count == 0) {
+        _start = Ticker::clock::now();
+        _intended = _start;
+      } else {
+        _intended += next_interval();
+      }
+      Ticker::sleep_until(_intended);
+    }
+    auto sent = Ticker::clock::now();
+    if (_rate <= 0) _intended = sent;
+
+    out["data"]["period"] = next_period();
 
     // Generate a unique ID
     uuid_t id;
@@ -60,8 +83,17 @@ public:
 
     // Assign the ID to the output JSON
     out["data"]["id"] = id_str;
+    out["data"]["seq"] = _count;
+    if (_payload_size > 0)
+      out["data"]["payload"] = string(next_payload_size(), 'x');
+
+    // Intended and actual send times, as system clock time in ns, and lag
+    out["data"]["intended"] = to_system_ns(_intended);
+    out["data"]["sent"] = to_system_ns(sent);
+    out["data"]["lag"] = chrono::duration<double, milli>(sent - _intended).count();
     
     if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    _count++;
     return return_type::success;
   }
 
@@ -69,34 +101,140 @@ public:
     Source::set_params(params);
     _params["period_min"] = 100;
     _params["period_max"] = 5000;
+    _params["period_distribution"] = "uniform";
     _params["number"] = 50;
+    _params["rate"] = 0.0;
+    _params["mode"] = "constant";
+    _params["burst_size"] = 10;
+    _params["rate_end"] = 0.0;
+    _params["ramp_duration"] = 60.0;
+    _params["payload_size"] = 0;
+    _params["payload_distribution"] = "fixed";
+    _params["startup_delay"] = 1000;
+    _params["seed"] = 0;
 
     _params.merge_patch(params);
     _number = _params["number"];
     _period_min = _params["period_min"];
     _period_max = _params["period_max"];
+    _period_distribution = _params["period_distribution"];
+    _rate = _params["rate"];
+    _mode = parse_mode(_params["mode"]);
+    _burst_size = max<size_t>(1, _params["burst_size"].get<size_t>());
+    _rate_end = _params["rate_end"];
+    if (_rate_end <= 0) _rate_end = _rate;
+    _ramp_duration = _params["ramp_duration"];
+    _payload_size = _params["payload_size"];
+    _payload_distribution = _params["payload_distribution"];
+    unsigned seed = _params["seed"];
+    _rng.seed(seed ? seed : random_device{}());
+    _count = 0;
 
-    for (size_t i = 0; i < _number; i++) {
-      size_t period = _period_min + (rand() % (_period_max - _period_min + 1));
-      _periods.push(period);
-    }
-    this_thread::sleep_for(chrono::milliseconds(1000));
+    // Offset between system and steady clocks, for reporting times
+    _offset = chrono::system_clock::now().time_since_epoch() -
+              Ticker::clock::now().time_since_epoch();
+
+    this_thread::sleep_for(chrono::milliseconds(_params["startup_delay"].get<long long>()));
   }
 
   // Implement this method if you want to provide additional information
   map<string, string> info() override { 
-    return {
+    map<string, string> i = {
       {"period_min", to_string(_period_min)},
       {"period_max", to_string(_period_max)},
-      {"number", to_string(_number)},
-    }; 
+      {"period_distribution", _period_distribution},
+      {"number", _number ? to_string(_number) : "unbounded"},
+    };
+    if (_rate > 0) {
+      i["rate"] = to_string(_rate) + " msg/s";
+      i["mode"] = _params["mode"];
+      if (_mode == mode::bursty) i["burst_size"] = to_string(_burst_size);
+      if (_mode == mode::ramp) 
+        i["ramp"] = "to " + to_string(_rate_end) + " msg/s in " + to_string(_ramp_duration) + " s";
+    }
+    if (_payload_size > 0) 
+      i["payload"] = to_string(_payload_size) + " B (" + _payload_distribution + ")";
+    return i;
   };
 
 private:
+  static mode parse_mode(const string &name) {
+    if (name == "poisson") return mode::poisson;
+    if (name == "bursty") return mode::bursty;
+    if (name == "ramp") return mode::ramp;
+    return mode::constant;
+  }
+
+  // Time between the intended send times of two consecutive messages
+  Ticker::clock::duration next_interval() {
+    double dt; // seconds
+    switch (_mode) {
+    case mode::poisson:
+      dt = exponential_distribution<double>(_rate)(_rng);
+      break;
+    case mode::bursty:
+      // bursts of back-to-back messages, with the same average rate
+      dt = (_count % _burst_size) ? 0.0 : _burst_size / _rate;
+      break;
+    case mode::ramp: {
+      double t = chrono::duration<double>(_intended - _start).count();
+      double f = _ramp_duration > 0 ? min(1.0, t / _ramp_duration) : 1.0;
+      double rate = _rate + (_rate_end - _rate) * f;
+      dt = rate > 0 ? 1.0 / rate : 1.0;
+      break;
+    }
+    default:
+      dt = 1.0 / _rate;
+    }
+    return chrono::duration_cast<Ticker::clock::duration>(chrono::duration<double>(dt));
+  }
+
+  // Job duration requested to the workers, in ms
+  size_t next_period() {
+    double p;
+    if (_period_distribution == "fixed") {
+      p = _period_min;
+    } else if (_period_distribution == "exponential") {
+      p = _period_min + exponential_distribution<double>(
+        1.0 / max<double>(1, (_period_max - _period_min) / 2.0))(_rng);
+    } else if (_period_distribution == "normal") {
+      p = normal_distribution<double>((_period_min + _period_max) / 2.0, 
+                                      (_period_max - _period_min) / 6.0)(_rng);
+    } else {
+      p = uniform_int_distribution<size_t>(_period_min, _period_max)(_rng);
+    }
+    return static_cast<size_t>(clamp<double>(round(p), _period_min, _period_max));
+  }
+
+  // Payload size, in bytes, with mean `payload_size`
+  size_t next_payload_size() {
+    if (_payload_distribution == "uniform")
+      return uniform_int_distribution<size_t>(0, 2 * _payload_size)(_rng);
+    if (_payload_distribution == "exponential")
+      return static_cast<size_t>(exponential_distribution<double>(
+        1.0 / max<size_t>(1, _payload_size))(_rng));
+    return _payload_size;
+  }
+
+  long long to_system_ns(Ticker::clock::time_point t) const {
+    return chrono::duration_cast<chrono::nanoseconds>(t.time_since_epoch() + _offset).count();
+  }
+
   size_t _period_min;
   size_t _period_max;
+  string _period_distribution;
   size_t _number;
-  queue<size_t> _periods;
+  size_t _count = 0;
+  double _rate = 0;
+  mode _mode = mode::constant;
+  size_t _burst_size = 1;
+  double _rate_end = 0;
+  double _ramp_duration = 0;
+  size_t _payload_size = 0;
+  string _payload_distribution;
+  mt19937_64 _rng;
+  Ticker::clock::time_point _start, _intended;
+  Ticker::clock::duration _offset;
 };
 
 
@@ -128,6 +266,9 @@ int main(int argc, char const *argv[]) {
   params["number"] = 10;
   params["period_min"] = 100;
   params["period_max"] = 5000;
+  // Optional open-loop rate: spawner [rate] [mode]
+  if (argc > 1) params["rate"] = atof(argv[1]);
+  if (argc > 2) params["mode"] = argv[2];
 
   // Set the parameters
   plugin.set_params(params);
@@ -0,0 +1,327 @@
+/*
+  ____   ___  _     _ _             _       _
+ / ___| / _ \| |   (_) |_ ___   ___(_)_ __ | | __
+ \___ \| | | | |   | | __/ _ \ / __| | '_ \| |/ /
+  ___) | |_| | |___| | ||  __/ \__ \ | | | |   <
+ |____/ \__\_\_____|_|\__\___| |___/_|_| |_|_|\_\
+
+Stores MADS messages in a SQLite database, with batched transactions
+*/
+
+#include "../sink.hpp"
+#include "../histogram.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "sqlite_sink"
+#endif
+
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+//
+// Each message becomes a row of `table`, with the receive time, the topic,
+// one column for each entry of `columns` (column name -> dotted field path),
+// and the remaining fields as JSON text in the `payload` column. Rows are
+// inserted with a prepared statement within a transaction, which is
+// committed every `batch_size` rows or `batch_interval` ms (by a timer
+// thread, so that rows are not left pending when messages stop).
+class SQLiteSink : public Sink<json> {
+  using clock = chrono::steady_clock;
+
+public:
+  ~SQLiteSink() { close(); }
+
+  string kind() override { return PLUGIN_NAME; }
+
+  return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    lock_guard<mutex> lock(_mtx);
+    if (!_insert) {
+      _error = "Database not open";
+      return return_type::error;
+    }
+    auto start = clock::now();
+    if (!_in_transaction) {
+      if (!exec("BEGIN")) return return_type::error;
+      _in_transaction = true;
+      _batch_start = start;
+    }
+
+    json rest = d;
+    int i = 1;
+    double now = chrono::duration<double>(chrono::system_clock::now().time_since_epoch()).count();
+    sqlite3_bind_double(_insert, i++, now);
+    sqlite3_bind_text(_insert, i++, topic.c_str(), static_cast<int>(topic.size()), SQLITE_TRANSIENT);
+    for (auto &[name, ptr] : _columns) {
+      if (d.contains(ptr)) {
+        bind(i++, d[ptr]);
+        erase(rest, ptr);
+      } else {
+        sqlite3_bind_null(_insert, i++);
+      }
+    }
+    string payload = rest.dump();
+    sqlite3_bind_text(_insert, i++, payload.c_str(), static_cast<int>(payload.size()), SQLITE_TRANSIENT);
+    int rc = sqlite3_step(_insert);
+    sqlite3_reset(_insert);
+    if (rc != SQLITE_DONE) {
+      _error = string("Insert failed: ") + sqlite3_errmsg(_db);
+      return return_type::error;
+    }
+    _batch_rows++;
+    _inserted++;
+    _insert_latency.add(chrono::duration<double, micro>(clock::now() - start).count());
+    if (_batch_rows >= _batch_size && !commit()) return return_type::error;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    Sink::set_params(params);
+    _params["path"] = "mads.db";
+    _params["table"] = "messages";
+    _params["columns"] = json::object(); // column name -> dotted field path
+    _params["batch_size"] = 1000;        // rows per transaction
+    _params["batch_interval"] = 1000;    // ms, max time before commit
+    _params["synchronous"] = "NORMAL";   // OFF, NORMAL, FULL
+    _params.merge_patch(params);
+    close();
+    _batch_size = max<size_t>(1, _params["batch_size"].get<size_t>());
+    _batch_interval = chrono::milliseconds(_params["batch_interval"].get<long long>());
+    _columns.clear();
+    for (auto &[name, path] : _params["columns"].items()) {
+      string p = "/" + path.get<string>();
+      replace(p.begin(), p.end(), '.', '/');
+      _columns.emplace_back(name, json::json_pointer(p));
+    }
+    if (!open()) {
+      cerr << "sqlite_sink: " << _error << endl;
+      return;
+    }
+    _stop = false;
+    _timer = thread(&SQLiteSink::timer_loop, this);
+  }
+
+  map<string, string> info() override {
+    return {
+      {"path", _params["path"]},
+      {"table", _params["table"]},
+      {"columns", _params["columns"].dump()},
+      {"batch", to_string(_batch_size) + " rows / " + to_string(_batch_interval.count()) + " ms"},
+      {"stats", stats().dump()}
+    };
+  };
+
+  // Insert and commit statistics
+  json stats() {
+    lock_guard<mutex> lock(_mtx);
+    return {
+      {"inserted", _inserted},
+      {"commits", _commit_latency.count()},
+      {"insert_latency_us", _insert_latency.summary()},
+      {"commit_latency_ms", _commit_latency.summary()},
+      {"insert_rate", _insert_rate.summary()}
+    };
+  }
+
+  // Commits the pending rows
+  bool flush() {
+    lock_guard<mutex> lock(_mtx);
+    return commit();
+  }
+
+private:
+  bool exec(const string &sql) {
+    char *msg = nullptr;
+    if (sqlite3_exec(_db, sql.c_str(), nullptr, nullptr, &msg) != SQLITE_OK) {
+      _error = "SQL error: " + string(msg ? msg : "") + " in " + sql;
+      sqlite3_free(msg);
+      return false;
+    }
+    return true;
+  }
+
+  static string quote(const string &name) {
+    string q = "\"";
+    for (char c : name) {
+      if (c == '"') q += '"';
+      q += c;
+    }
+    return q + '"';
+  }
+
+  bool open() {
+    lock_guard<mutex> lock(_mtx);
+    string path = _params["path"];
+    if (sqlite3_open(path.c_str(), &_db) != SQLITE_OK) {
+      _error = "Cannot open " + path + ": " + sqlite3_errmsg(_db);
+      sqlite3_close(_db);
+      _db = nullptr;
+      return false;
+    }
+    string table = quote(_params["table"]);
+    string create = "CREATE TABLE IF NOT EXISTS " + table +
+                    " (id INTEGER PRIMARY KEY, time REAL, topic TEXT";
+    string insert = "INSERT INTO " + table + " (time, topic";
+    string values = "?, ?";
+    for (auto &[name, ptr] : _columns) {
+      create += ", " + quote(name);
+      insert += ", " + quote(name);
+      values += ", ?";
+    }
+    create += ", payload TEXT)";
+    insert += ", payload) VALUES (" + values + ", ?)";
+    if (!exec("PRAGMA journal_mode=WAL") ||
+        !exec("PRAGMA synchronous=" + _params["synchronous"].get<string>()) ||
+        !exec(create) ||
+        !exec("CREATE INDEX IF NOT EXISTS " + quote(_params["table"].get<string>() + "_time") +
+              " ON " + table + " (time)"))
+      return false;
+    if (sqlite3_prepare_v2(_db, insert.c_str(), -1, &_insert, nullptr) != SQLITE_OK) {
+      _error = string("Cannot prepare insert: ") + sqlite3_errmsg(_db);
+      return false;
+    }
+    return true;
+  }
+
+  void close() {
+    if (_timer.joinable()) {
+      {
+        lock_guard<mutex> lock(_mtx);
+        _stop = true;
+      }
+      _cv.notify_one();
+      _timer.join();
+    }
+    lock_guard<mutex> lock(_mtx);
+    commit();
+    sqlite3_finalize(_insert);
+    _insert = nullptr;
+    sqlite3_close(_db);
+    _db = nullptr;
+  }
+
+  // Call with _mtx locked
+  bool commit() {
+    if (!_in_transaction) return true;
+    auto start = clock::now();
+    bool ok = exec("COMMIT");
+    auto end = clock::now();
+    _in_transaction = false;
+    _commit_latency.add(chrono::duration<double, milli>(end - start).count());
+    double secs = chrono::duration<double>(end - _batch_start).count();
+    if (secs > 0) _insert_rate.add(_batch_rows / secs);
+    _batch_rows = 0;
+    return ok;
+  }
+
+  // Commits the transaction when it is older than the batch interval
+  void timer_loop() {
+    unique_lock<mutex> lock(_mtx);
+    while (!_stop) {
+      auto deadline = _in_transaction ? _batch_start + _batch_interval : clock::now() + _batch_interval;
+      _cv.wait_until(lock, deadline, [this] { return _stop; });
+      if (_in_transaction && clock::now() - _batch_start >= _batch_interval) commit();
+    }
+  }
+
+  void bind(int i, const json &v) {
+    if (v.is_boolean()) sqlite3_bind_int(_insert, i, v.get<bool>());
+    else if (v.is_number_integer()) sqlite3_bind_int64(_insert, i, v.get<int64_t>());
+    else if (v.is_number()) sqlite3_bind_double(_insert, i, v.get<double>());
+    else if (v.is_null()) sqlite3_bind_null(_insert, i);
+    else {
+      string s = v.is_string() ? v.get<string>() : v.dump();
+      sqlite3_bind_text(_insert, i, s.c_str(), static_cast<int>(s.size()), SQLITE_TRANSIENT);
+    }
+  }
+
+  // Removes a mapped field from the payload, and its parents if left empty
+  static void erase(json &j, json::json_pointer ptr) {
+    while (!ptr.empty()) {
+      string key = ptr.back();
+      ptr.pop_back();
+      json &parent = j[ptr];
+      if (!parent.is_object()) return;
+      parent.erase(key);
+      if (!parent.empty()) return;
+    }
+  }
+
+  json _params;
+  vector<pair<string, json::json_pointer>> _columns;
+  size_t _batch_size = 1000;
+  chrono::milliseconds _batch_interval{1000};
+  sqlite3 *_db = nullptr;
+  sqlite3_stmt *_insert = nullptr;
+  bool _in_transaction = false;
+  size_t _batch_rows = 0, _inserted = 0;
+  clock::time_point _batch_start;
+  Histogram _insert_latency{0.1, 1e6};  // us
+  Histogram _commit_latency{1e-3, 1e5}; // ms
+  Histogram _insert_rate{1, 1e8};       // rows/s, per transaction
+  mutex _mtx;
+  condition_variable _cv;
+  thread _timer;
+  bool _stop = false;
+};
+
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_SINK_DRIVER(SQLiteSink, json)
+
+
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+For testing purposes, when directly executing the plugin
+*/
+int main(int argc, char const *argv[]) {
+  // sqlite_sink [n] [batch_size] [path]
+  size_t n = argc > 1 ? atoi(argv[1]) : 100000;
+  string path = argc > 3 ? argv[3] : (filesystem::temp_directory_path() / "sqlite_sink.db").string();
+  SQLiteSink sink;
+  sink.set_params({
+    {"path", path},
+    {"batch_size", argc > 2 ? atoi(argv[2]) : 1000},
+    {"columns", {{"x", "data.x"}, {"agent", "agent_id"}}}
+  });
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++) {
+    json data = {{"agent_id", "edge1"}, {"data", {{"x", 0.5 * i}, {"y", i}}}};
+    if (sink.load_data(data, "sensors") != return_type::success) {
+      cerr << sink.error() << endl;
+      return 1;
+    }
+  }
+  sink.flush();
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  cout << n / elapsed.count() << " rows/s into " << path << endl;
+  cout << "Stats: " << sink.stats().dump(2) << endl;
+  return 0;
+}
@@ -9,8 +9,15 @@ It takes a JSON input and returns it as output, enriched with the parameters
 */
 
 #include "../sink.hpp"
+#include "../topic_trie.hpp"
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
 
 #ifndef PLUGIN_NAME
 #define PLUGIN_NAME "to_console"
@@ -22,28 +29,140 @@ using json = nlohmann::json;
 
 // Plugin class. This shall be the only part that needs to be modified,
 // implementing the actual functionality
+//
+// Lines are formatted in load_data() and appended to an in-memory buffer;
+// a background thread swaps it with a second buffer and writes it to stdout
+// every `flush_interval` ms, or as soon as it is half full. The hot path
+// only takes a mutex for the append: if the terminal cannot keep up and the
+// buffer is full, messages are dropped (and counted) rather than waiting.
 class ToConsole : public Sink<json> {
 public:
+  ~ToConsole() { stop(); }
+
   string kind() override { return PLUGIN_NAME; }
   return_type load_data(json const &d, string topic = "", vector<unsigned char> const *blob = nullptr) override {
-    _data = d;
-    cout << "[" << topic << "] Data: " << _data << endl;
+    _received++;
+    // topic filter, sampling and rate limit
+    if (!_topics.empty() && !_topics.matches(topic)) {
+      _filtered++;
+      return return_type::success;
+    }
+    if (_sample_every > 1 && (_received - 1) % _sample_every != 0) {
+      _filtered++;
+      return return_type::success;
+    }
+    if (_max_rate > 0 && !take_token()) {
+      _filtered++;
+      return return_type::success;
+    }
+
+    string line = "[" + topic + "] Data: " + d.dump(_indent) + "\n";
+    {
+      lock_guard<mutex> lock(_mtx);
+      if (_front.size() + line.size() > _buffer_size) {
+        _dropped++;
+        return return_type::success;
+      }
+      _front += line;
+      _printed++;
+      if (_front.size() < _buffer_size / 2) return return_type::success;
+    }
+    _cv.notify_one();
     return return_type::success;
   }
 
   void set_params(const json &params) override { 
     Sink::set_params(params);
+    _params["sample_every"] = 1;
+    _params["max_rate"] = 0.0;         // messages per second, 0 for no limit
+    _params["topics"] = json::array(); // topic filters, empty for all
+    _params["pretty"] = false;
+    _params["buffer_size"] = 1024;     // KiB
+    _params["flush_interval"] = 100;   // ms
     _params.merge_patch(params); 
+    _sample_every = max<size_t>(1, _params["sample_every"].get<size_t>());
+    _max_rate = _params["max_rate"];
+    _tokens = _max_rate;
+    _last_token = chrono::steady_clock::now();
+    _topics = TopicTrie<size_t>();
+    for (auto &t : _params["topics"]) _topics.insert(t.get<string>(), _topics.size());
+    _indent = _params["pretty"].get<bool>() ? 2 : -1;
+    _buffer_size = _params["buffer_size"].get<size_t>() * 1024;
+    _flush_interval = chrono::milliseconds(_params["flush_interval"].get<long long>());
+    stop();
+    _front.reserve(_buffer_size);
+    _back.reserve(_buffer_size);
+    _stop = false;
+    _writer = thread(&ToConsole::write_loop, this);
   }
 
   map<string, string> info() override {
     map<string, string> m;
     m["params"] = _params.dump();
+    m["printed"] = to_string(_printed);
+    m["filtered"] = to_string(_filtered);
+    m["dropped"] = to_string(_dropped);
     return m;
   };
 
+  size_t dropped() const { return _dropped; }
+
 private:
-  json _data, _params;
+  // Token bucket allowing bursts of up to one second of messages
+  bool take_token() {
+    auto now = chrono::steady_clock::now();
+    _tokens = min(_max_rate, _tokens + _max_rate * chrono::duration<double>(now - _last_token).count());
+    _last_token = now;
+    if (_tokens < 1) return false;
+    _tokens -= 1;
+    return true;
+  }
+
+  void write_loop() {
+    unique_lock<mutex> lock(_mtx);
+    while (true) {
+      _cv.wait_for(lock, _flush_interval, [this] {
+        return _stop || _front.size() >= _buffer_size / 2;
+      });
+      bool stopping = _stop;
+      swap(_front, _back);
+      lock.unlock();
+      if (!_back.empty()) {
+        fwrite(_back.data(), 1, _back.size(), stdout);
+        fflush(stdout);
+        _back.clear();
+      }
+      lock.lock();
+      if (stopping && _front.empty()) return;
+    }
+  }
+
+  // Stops the writer thread, writing out the buffer
+  void stop() {
+    if (!_writer.joinable()) return;
+    {
+      lock_guard<mutex> lock(_mtx);
+      _stop = true;
+    }
+    _cv.notify_one();
+    _writer.join();
+  }
+
+  json _params;
+  TopicTrie<size_t> _topics;
+  size_t _sample_every = 1;
+  double _max_rate = 0, _tokens = 0;
+  chrono::steady_clock::time_point _last_token;
+  int _indent = -1;
+  size_t _buffer_size = 1 << 20;
+  chrono::milliseconds _flush_interval{100};
+  string _front, _back;
+  mutex _mtx;
+  condition_variable _cv;
+  thread _writer;
+  bool _stop = false;
+  size_t _received = 0, _filtered = 0, _printed = 0;
+  atomic<size_t> _dropped{0};
 };
 
 
@@ -85,9 +204,22 @@ int main(int argc, char const *argv[]) {
     json j = json::parse(ss.str());
     data = j["data"];
     params = j["params"];
+  } else if (argc > 1 && argv[1] == string("bench")) {
+    // Time spent in load_data, output to stdout (redirect it to a file)
+    size_t n = argc > 2 ? atoi(argv[2]) : 100000;
+    tc.set_params({{"buffer_size", 16384}});
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      data["i"] = i;
+      tc.load_data(data, "bench");
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cerr << n / elapsed.count() << " msg/s, " << tc.dropped() << " dropped" << endl;
+    return 0;
   } else if (argc > 1) {
-    cout << "Usage: " << argv[0] << " [-]" << endl;
+    cout << "Usage: " << argv[0] << " [-|bench [n]]" << endl;
     cout << "       use the optional '-' to read input from stdin" << endl;
+    cout << "       use 'bench' to measure the throughput to stdout" << endl;
     return 1;
   }
 
@@ -9,11 +9,28 @@ This is a worker plugin to show how to use the dealer/worker pattern
 */
 // Mandatory included headers
 #include "../filter.hpp"
+#include "../thread_pool.hpp"
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 // other includes as needed here
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
 
 // Define the name of the plugin
 #ifndef PLUGIN_NAME
@@ -25,11 +42,50 @@ using namespace std;
 using json = nlohmann::json;
 
 
+// Keeps the result of the cpu workload, so that it is not optimized away
+static thread_local volatile double spin_sink;
+
+// CPU time consumed by the calling thread, in ms
+static double thread_cpu_ms() {
+#ifdef _WIN32
+  FILETIME creation, exit, kernel, user;
+  GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+  auto ticks = [](FILETIME &f) { 
+    return (static_cast<unsigned long long>(f.dwHighDateTime) << 32) | f.dwLowDateTime; 
+  };
+  return (ticks(kernel) + ticks(user)) / 1.0e4; // 100 ns units
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1.0e3 + ts.tv_nsec / 1.0e6;
+#endif
+}
+
+
 // Plugin class. This shall be the only part that needs to be modified,
 // implementing the actual functionality
+//
+// Each job requests a cost of `period` ms, spent according to `mode`:
+// - `sleep`: sleeps (the default, no resources used);
+// - `cpu`: spins on an arithmetic loop, with the instruction mix given by
+//   `cpu_mix` (int, float, mixed, branch);
+// - `memory`: reads and writes a buffer of `working_set` KiB with a `stride`
+//   in bytes, stressing caches (small sets) or memory bandwidth (large sets);
+// - `io`: writes `io_size` KiB to a temporary file in `io_dir`, syncs it to
+//   disk and reads it back.
+// The cpu and memory loops are calibrated in set_params() on an idle core,
+// so the work of a job is fixed: when workers compete for cores or memory
+// bandwidth, the measured `elapsed` (wall) time grows beyond `requested`.
+//
+// With `concurrency` > 1, up to that many jobs are in flight at once on an
+// internal work-stealing thread pool: load_data() queues the job, and
+// process() returns the results completed so far, in completion order (as
+// a `batch` when more than one), or retry if none. When all slots are busy,
+// process() waits for a job to complete, applying backpressure upstream.
 class WorkerPlugin : public Filter<json, json> {
 
 public:
+  enum class mode { sleep, cpu, memory, io };
 
   string kind() override { return PLUGIN_NAME; }
 
@@ -40,38 +96,275 @@ public:
     }
     _sleep_request = chrono::milliseconds(input["data"].value("period", 100));
     _id = input["data"].value("id", "");
+    if (_pool) {
+      if (_sleep_request.count() < 0) {
+        _error = "Invalid sleep period";
+        return return_type::error;
+      }
+      unique_lock<mutex> lock(_done_mtx);
+      _done_cv.wait(lock, [this] { return _inflight < _concurrency; });
+      _inflight++;
+      lock.unlock();
+      _pool->submit([this, requested = _sleep_request.count(), id = _id] {
+        json result = run(requested);
+        result["id"] = id;
+        {
+          lock_guard<mutex> lock(_done_mtx);
+          _done.push_back(std::move(result));
+          _inflight--;
+        }
+        _done_cv.notify_all();
+      });
+    }
     return return_type::success;
   }
 
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
     out.clear();
+    if (_pool) return collect(out);
     if (_sleep_request.count() < 0) {
       _error = "Invalid sleep period";
       return return_type::error;
     }
-    const auto start = chrono::high_resolution_clock::now();
-    this_thread::sleep_for(_sleep_request);
-    const auto end = std::chrono::high_resolution_clock::now();
-    const chrono::duration<double, std::milli> elapsed = end - start;  
-    out["requested"] = _sleep_request.count();
-    out["elapsed"] = elapsed.count();
+    out = run(_sleep_request.count());
     out["id"] = _id;
     if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    if (out.contains("error")) {
+      _error = out["error"];
+      return return_type::error;
+    }
     return return_type::success;
   }
   
   void set_params(const json &params) override {
+    // jobs in flight read the configuration: let them complete first
+    _pool.reset();
     Filter::set_params(params);
+    _params["mode"] = "sleep";
+    _params["cpu_mix"] = "mixed";
+    _params["working_set"] = 1024; // KiB
+    _params["stride"] = 64;        // bytes
+    _params["io_size"] = 1024;     // KiB
+    _params["io_dir"] = filesystem::temp_directory_path().string();
     _params.merge_patch(params);
+    string m = _params["mode"];
+    _mode = m == "cpu" ? mode::cpu : m == "memory" ? mode::memory : m == "io" ? mode::io : mode::sleep;
+    _cpu_mix = _params["cpu_mix"];
+    _working_set = max<size_t>(1, _params["working_set"].get<size_t>()) * 1024;
+    _stride = max<size_t>(1, _params["stride"].get<size_t>());
+    _io_size = _params["io_size"].get<size_t>() * 1024;
+    _io_dir = _params["io_dir"].get<string>();
+    calibrate();
+    _concurrency = max<size_t>(1, _params.value("concurrency", 1));
+    if (_concurrency > 1) {
+      size_t threads = _params.value("threads", 0);
+      _pool = make_unique<ThreadPool>(threads ? threads : _concurrency);
+    }
   }
 
+  ~WorkerPlugin() { _pool.reset(); }
+
   map<string, string> info() override { 
-    return {}; 
+    map<string, string> i = {{"mode", _params.value("mode", "sleep")}};
+    if (_pool) {
+      i["concurrency"] = to_string(_concurrency);
+      i["threads"] = to_string(_pool->size());
+    }
+    switch (_mode) {
+    case mode::cpu:
+      i["cpu_mix"] = _cpu_mix;
+      i["calibration"] = to_string(_units_per_ms) + " loops/ms";
+      break;
+    case mode::memory:
+      i["working_set"] = to_string(_working_set / 1024) + " KiB";
+      i["stride"] = to_string(_stride) + " B";
+      i["calibration"] = to_string(_units_per_ms) + " accesses/ms";
+      break;
+    case mode::io:
+      i["io_size"] = to_string(_io_size / 1024) + " KiB";
+      i["io_dir"] = _io_dir.string();
+      break;
+    default:
+      break;
+    }
+    return i; 
   };
 
+  // Runs a job of the requested cost (ms), returning the measured cost.
+  // It can be called concurrently from multiple threads.
+  json run(long long requested) const {
+    json out;
+    const auto start = chrono::steady_clock::now();
+    const double cpu_start = thread_cpu_ms();
+    switch (_mode) {
+    case mode::cpu:
+      spin(static_cast<size_t>(requested * _units_per_ms));
+      break;
+    case mode::memory: {
+      size_t accesses = static_cast<size_t>(requested * _units_per_ms);
+      touch(accesses);
+      out["bytes"] = accesses * _stride;
+      break;
+    }
+    case mode::io: {
+      string err = file_io();
+      if (!err.empty()) out["error"] = err;
+      out["bytes"] = 2 * _io_size;
+      break;
+    }
+    default:
+      this_thread::sleep_for(chrono::milliseconds(requested));
+    }
+    const chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+    out["requested"] = requested;
+    out["elapsed"] = elapsed.count();
+    out["cpu"] = thread_cpu_ms() - cpu_start;
+    out["mode"] = _params.value("mode", "sleep");
+    if (out.contains("bytes") && elapsed.count() > 0)
+      out["throughput"] = out["bytes"].get<double>() / elapsed.count() / 1.0e3; // MB/s
+    return out;
+  }
+
 private:
+  // Returns the completed results, waiting for one if all slots are busy.
+  // A failed job is returned alone, as an error, as in the inline case: the
+  // results completed after it are left for the next call.
+  return_type collect(json &out) {
+    unique_lock<mutex> lock(_done_mtx);
+    _done_cv.wait(lock, [this] { return !_done.empty() || _inflight < _concurrency; });
+    if (_done.empty()) return return_type::retry;
+    if (_done.front().contains("error")) {
+      out = std::move(_done.front());
+      _done.pop_front();
+      lock.unlock();
+      stamp_agent(out);
+      _error = out["error"];
+      return return_type::error;
+    }
+    auto last = find_if(_done.begin(), _done.end(),
+                        [](const json &r) { return r.contains("error"); });
+    size_t n = last - _done.begin();
+    if (n == 1) {
+      out = std::move(_done.front());
+    } else {
+      out["batch"] = json::array();
+      for (auto it = _done.begin(); it != last; ++it) out["batch"].push_back(std::move(*it));
+      out["count"] = n;
+    }
+    _done.erase(_done.begin(), last);
+    lock.unlock();
+    stamp_agent(out);
+    return return_type::success;
+  }
+
+  void stamp_agent(json &out) {
+    if (_agent_id.empty()) return;
+    if (out.contains("batch")) {
+      for (auto &r : out["batch"]) r["agent_id"] = _agent_id;
+    } else {
+      out["agent_id"] = _agent_id;
+    }
+  }
+
+  // Measures the loops (cpu) or accesses (memory) per ms on this core
+  void calibrate() {
+    if (_mode != mode::cpu && _mode != mode::memory) return;
+    auto work = [this](size_t n) { _mode == mode::cpu ? spin(n) : touch(n); };
+    work(1000); // warm up, and allocate the working set
+    size_t n = 1000;
+    double ms = 0;
+    while (ms < 50) {
+      n *= 2;
+      auto start = chrono::steady_clock::now();
+      work(n);
+      ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    _units_per_ms = n / ms;
+  }
+
+  // Each loop is a short dependency chain of operations, with a mix given
+  // by _cpu_mix; the result is stored in a volatile to keep the loop alive
+  void spin(size_t loops) const {
+    uint64_t x = 88172645463325252ULL;
+    double f = 1.0;
+    if (_cpu_mix == "int") {
+      for (size_t i = 0; i < loops; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        x *= 0x9E3779B97F4A7C15ULL;
+      }
+    } else if (_cpu_mix == "float") {
+      for (size_t i = 0; i < loops; i++) {
+        f = f * 1.0000001 + 1e-9;
+        f = sqrt(f * f + 1e-12);
+      }
+    } else if (_cpu_mix == "branch") {
+      for (size_t i = 0; i < loops; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        if (x & 1) f += 1.0; else f -= 0.5;
+        if (x & 2) x += 3;
+      }
+    } else { // mixed
+      for (size_t i = 0; i < loops; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        f = f * 1.0000001 + static_cast<double>(x & 0xFF) * 1e-9;
+      }
+    }
+    spin_sink = f + static_cast<double>(x);
+  }
+
+  // Read-modify-write of one byte every _stride bytes of the working set,
+  // wrapping around it. The buffer is per thread.
+  void touch(size_t accesses) const {
+    thread_local vector<unsigned char> buffer;
+    if (buffer.size() != _working_set) buffer.assign(_working_set, 1);
+    unsigned char *p = buffer.data();
+    size_t pos = 0;
+    for (size_t i = 0; i < accesses; i++) {
+      p[pos]++;
+      pos += _stride;
+      if (pos >= _working_set) pos -= _working_set;
+    }
+  }
+
+  // Writes, syncs, reads back and removes a temporary file
+  string file_io() const {
+    static atomic<size_t> counter{0};
+    filesystem::path path = _io_dir / ("worker_" + to_string(counter++) + "_" + 
+      to_string(hash<thread::id>{}(this_thread::get_id())) + ".tmp");
+    vector<char> chunk(64 * 1024, 'x');
+    FILE *file = fopen(path.string().c_str(), "wb");
+    if (!file) return "Cannot create " + path.string();
+    for (size_t done = 0; done < _io_size; done += chunk.size())
+      fwrite(chunk.data(), 1, min(chunk.size(), _io_size - done), file);
+    fflush(file);
+#ifndef _WIN32
+    fsync(fileno(file));
+#endif
+    fclose(file);
+    file = fopen(path.string().c_str(), "rb");
+    if (!file) return "Cannot read " + path.string();
+    while (fread(chunk.data(), 1, chunk.size(), file) > 0) {}
+    fclose(file);
+    error_code ec;
+    filesystem::remove(path, ec);
+    return "";
+  }
+
   chrono::milliseconds _sleep_request;
   string _id;
+  mode _mode = mode::sleep;
+  string _cpu_mix;
+  size_t _working_set = 0;
+  size_t _stride = 64;
+  size_t _io_size = 0;
+  filesystem::path _io_dir;
+  double _units_per_ms = 0;
+  size_t _concurrency = 1;
+  unique_ptr<ThreadPool> _pool;
+  mutex _done_mtx;
+  condition_variable _done_cv;
+  deque<json> _done;   // completed results, in completion order
+  size_t _inflight = 0;
 };
 
 
@@ -102,26 +395,50 @@ int main(int argc, char const *argv[])
   json params;
   json input, output;
 
-  // Set example values to params
-  params["test"] = "value";
+  // Set example values to params: worker [mode] [period] [concurrency]
+  params["mode"] = argc > 1 ? argv[1] : "sleep";
+  params["concurrency"] = argc > 3 ? atoi(argv[3]) : 1;
 
   // Set the parameters
   plugin.set_params(params);
 
   // Set input data
   input["data"] = {
-    {"period", 1000}
+    {"period", argc > 2 ? atoi(argv[2]) : 1000}
   };
 
-  // Set input data
-  plugin.load_data(input);
-  cout << "Input: " << input.dump(2) << endl;
+  if (params["concurrency"] == 1) {
+    // Set input data
+    plugin.load_data(input);
+    cout << "Input: " << input.dump(2) << endl;
 
-  // Process data
-  plugin.process(output);
-  cout << "Output: " << output.dump(2) << endl;
+    // Process data
+    plugin.process(output);
+    cout << "Output: " << output.dump(2) << endl;
+    return 0;
+  }
 
+  // Concurrent jobs: feed twice as many jobs as slots, then drain
+  size_t jobs = 2 * params["concurrency"].get<size_t>(), received = 0;
+  auto start = chrono::steady_clock::now();
+  for (size_t i = 0; i < jobs; i++) {
+    input["data"]["id"] = "job-" + to_string(i);
+    plugin.load_data(input);
+    if (plugin.process(output) != return_type::retry) {
+      received += output.value("count", 1);
+      cout << "Output: " << output << endl;
+    }
+  }
+  while (received < jobs) {
+    if (plugin.process(output) != return_type::retry) {
+      received += output.value("count", 1);
+      cout << "Output: " << output << endl;
+    } else {
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+  }
+  chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+  cout << "Completed " << jobs << " jobs in " << elapsed.count() << " ms" << endl;
 
   return 0;
 }
-
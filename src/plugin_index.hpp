@@ -0,0 +1,279 @@
+/*
+  ____  _             _         ___           _
+ |  _ \| |_   _  __ _(_)_ __   |_ _|_ __   __| | _____  __
+ | |_) | | | | |/ _` | | '_ \   | || '_ \ / _` |/ _ \ \/ /
+ |  __/| | |_| | (_| | | | | |  | || | | | (_| |  __/>  <
+ |_|   |_|\__,_|\__, |_|_| |_| |___|_| |_|\__,_|\___/_/\_\
+                |___/
+ PluginIndex class, finding drivers in a directory of plugins
+*/
+
+#ifndef PLUGIN_INDEX_HPP
+#define PLUGIN_INDEX_HPP
+
+#include "filter.hpp"
+#include "sink.hpp"
+#include "source.hpp"
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*!
+ * Index of the drivers available in a directory of `.plugin` files
+ *
+ * scan() lists the plugins in the directory and records, for each of them,
+ * the drivers it provides (name, server, protocol version and
+ * capabilities). To get them, a plugin is loaded in a throwaway
+ * pugg::Kernel and its drivers are queried; no plugin instance is created,
+ * so scanning runs no plugin constructors, and capabilities are those the
+ * driver declares (see FilterDriver::capabilities()). The index is cached
+ * in a JSON file, and a plugin
+ * is loaded again only when it changes: when its modification time and size
+ * are those in the cache, nothing is read; otherwise its FNV-1a hash is
+ * compared with the cached one, so that a file that was just copied or
+ * touched is not loaded either. The cache is discarded when the protocol
+ * version of the host changes.
+ *
+ * Hosts then call find() to get the path of the plugin with the driver they
+ * need, and load only that one.
+ */
+class PluginIndex {
+  using FilterDriverJ = FilterDriver<nlohmann::json, nlohmann::json>;
+  using clock = std::chrono::steady_clock;
+
+public:
+  /*!
+   * Index of the plugins in `dir`. By default, the cache goes to
+   * `$TMPDIR/mads/plugins-<hash of dir>.json`, as the plugin directory may
+   * not be writable.
+   */
+  PluginIndex(std::filesystem::path dir, std::filesystem::path cache = "")
+      : _dir(std::filesystem::absolute(dir)), _cache(cache),
+        _index({{"plugins", nlohmann::json::object()}}) {
+    if (_cache.empty()) {
+      std::string d = _dir.string();
+      _cache = std::filesystem::temp_directory_path() / "mads" /
+               ("plugins-" + hex(hash(d.data(), d.size())) + ".json");
+    }
+  }
+
+  /*!
+   * Updates the index and saves the cache if anything changed. Returns false
+   * if the directory cannot be read.
+   */
+  bool scan() {
+    auto start = clock::now();
+    _scanned = _cached = _hashed = _loaded = _removed = 0;
+    read_cache();
+    nlohmann::json plugins = nlohmann::json::object();
+    std::error_code ec;
+    std::filesystem::directory_iterator it(_dir, ec), end;
+    if (ec) {
+      _error = "Cannot read " + _dir.string() + ": " + ec.message();
+      return false;
+    }
+    bool changed = false;
+    for (; it != end; it.increment(ec)) {
+      if (ec) break;
+      auto &path = it->path();
+      if (path.extension() != ".plugin" || !it->is_regular_file(ec)) continue;
+      std::string file = path.filename().string();
+      int64_t mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+      uintmax_t size = std::filesystem::file_size(path, ec);
+      _scanned++;
+      nlohmann::json entry = _index["plugins"].value(file, nlohmann::json::object());
+      if (entry.value("mtime", int64_t(0)) == mtime && entry.value("size", uintmax_t(0)) == size) {
+        _cached++;
+        plugins[file] = entry;
+        continue;
+      }
+      changed = true;
+      std::string h = hex(hash_file(path));
+      if (entry.value("hash", "") == h) {
+        _hashed++;
+      } else {
+        entry = inspect(path);
+        entry["hash"] = h;
+        _loaded++;
+      }
+      entry["mtime"] = mtime;
+      entry["size"] = size;
+      plugins[file] = entry;
+    }
+    for (auto &[file, entry] : _index["plugins"].items()) {
+      if (!plugins.contains(file)) _removed++;
+    }
+    changed = changed || _removed > 0 || !_cache_valid;
+    _index = {{"protocol", PLUGIN_PROTOCOL_VERSION}, {"dir", _dir.string()}, {"plugins", plugins}};
+    if (changed) write_cache();
+    _duration = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    return true;
+  }
+
+  /*!
+   * Path of the plugin with the driver `name` for `server` (e.g.
+   * `Filter<>::server_name()`), or empty if there is none. With an empty
+   * `name`, the first plugin with a driver for `server`.
+   */
+  std::filesystem::path find(const std::string &server, const std::string &name = "") const {
+    for (auto &[file, entry] : _index["plugins"].items()) {
+      for (auto &d : entry.value("drivers", nlohmann::json::array())) {
+        if (d["server"] == server && (name.empty() || d["name"] == name)) return _dir / file;
+      }
+    }
+    return {};
+  }
+
+  /*!
+   * The drivers for `server` (all of them if empty), each with the file
+   * that provides it
+   */
+  nlohmann::json drivers(const std::string &server = "") const {
+    nlohmann::json list = nlohmann::json::array();
+    for (auto &[file, entry] : _index["plugins"].items()) {
+      for (auto d : entry.value("drivers", nlohmann::json::array())) {
+        if (!server.empty() && d["server"] != server) continue;
+        d["file"] = file;
+        list.push_back(d);
+      }
+    }
+    return list;
+  }
+
+  /*!
+   * Loads the plugin with the driver `name` for `server` into the kernel
+   */
+  bool load(pugg::Kernel &kernel, const std::string &server, const std::string &name = "") {
+    std::filesystem::path path = find(server, name);
+    if (path.empty()) {
+      _error = "No driver " + name + " for " + server + " in " + _dir.string();
+      return false;
+    }
+    return kernel.load_plugin(path.string());
+  }
+
+  /*!
+   * The whole index, as saved in the cache
+   */
+  const nlohmann::json &index() const { return _index; }
+
+  /*!
+   * Statistics of the last scan: plugins found, unchanged ones, changed
+   * ones with the same content, loaded ones, removed ones, and duration (ms)
+   */
+  nlohmann::json stats() const {
+    return {
+      {"plugins", _scanned},
+      {"cached", _cached},
+      {"hashed", _hashed},
+      {"loaded", _loaded},
+      {"removed", _removed},
+      {"scan_ms", _duration}
+    };
+  }
+
+  std::filesystem::path cache_path() const { return _cache; }
+  std::string error() const { return _error; }
+
+private:
+  // Loads the plugin in a throwaway kernel and describes its drivers
+  nlohmann::json inspect(const std::filesystem::path &path) {
+    nlohmann::json entry = {{"drivers", nlohmann::json::array()}};
+    pugg::Kernel kernel;
+    kernel.add_server<Filter<>>();
+    kernel.add_server<Source<>>();
+    kernel.add_server<Sink<>>();
+    if (!kernel.load_plugin(path.string())) {
+      entry["error"] = "cannot load";
+      return entry;
+    }
+    for (auto d : kernel.get_all_drivers<FilterDriverJ>(Filter<>::server_name()))
+      entry["drivers"].push_back(describe(d, d->capabilities()));
+    for (auto d : kernel.get_all_drivers<pugg::Driver>(Source<>::server_name()))
+      entry["drivers"].push_back(describe(d, nlohmann::json::array()));
+    for (auto d : kernel.get_all_drivers<pugg::Driver>(Sink<>::server_name()))
+      entry["drivers"].push_back(describe(d, nlohmann::json::array()));
+    kernel.clear_drivers();
+    return entry;
+  }
+
+  static nlohmann::json describe(pugg::Driver *d, const nlohmann::json &caps) {
+    return {
+      {"name", d->name()},
+      {"server", d->server_name()},
+      {"version", d->version()},
+      {"capabilities", caps}
+    };
+  }
+
+  void read_cache() {
+    _cache_valid = false;
+    _index = {{"plugins", nlohmann::json::object()}};
+    std::ifstream ifs(_cache);
+    if (!ifs.is_open()) return;
+    nlohmann::json cache = nlohmann::json::parse(ifs, nullptr, false);
+    // a cache from another protocol version, or another directory, is ignored
+    if (cache.is_discarded() || cache.value("protocol", 0) != PLUGIN_PROTOCOL_VERSION ||
+        cache.value("dir", "") != _dir.string() || !cache["plugins"].is_object())
+      return;
+    _index = cache;
+    _cache_valid = true;
+  }
+
+  void write_cache() {
+    std::error_code ec;
+    std::filesystem::create_directories(_cache.parent_path(), ec);
+    std::filesystem::path tmp = _cache;
+    tmp += ".tmp";
+    {
+      std::ofstream ofs(tmp);
+      if (!ofs.is_open()) {
+        _error = "Cannot write " + tmp.string();
+        return;
+      }
+      ofs << _index.dump(2);
+    }
+    std::filesystem::rename(tmp, _cache, ec);
+    if (ec) _error = "Cannot write " + _cache.string() + ": " + ec.message();
+  }
+
+  static uint64_t hash(const char *data, size_t len, uint64_t h = 14695981039346656037ULL) {
+    for (size_t i = 0; i < len; i++) {
+      h ^= static_cast<unsigned char>(data[i]);
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  static uint64_t hash_file(const std::filesystem::path &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    std::vector<char> buf(1 << 16);
+    uint64_t h = 14695981039346656037ULL;
+    while (ifs) {
+      ifs.read(buf.data(), buf.size());
+      h = hash(buf.data(), static_cast<size_t>(ifs.gcount()), h);
+    }
+    return h;
+  }
+
+  static std::string hex(uint64_t h) {
+    char buf[17];
+    snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(h));
+    return buf;
+  }
+
+  std::filesystem::path _dir, _cache;
+  nlohmann::json _index;
+  bool _cache_valid = false;
+  std::string _error;
+  size_t _scanned = 0, _cached = 0, _hashed = 0, _loaded = 0, _removed = 0;
+  double _duration = 0;
+};
+
+#endif // PLUGIN_INDEX_HPP
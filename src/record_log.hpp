@@ -0,0 +1,375 @@
+/*
+  ____                        _   _
+ |  _ \ ___  ___ ___  _ __ __| | | |    ___   __ _
+ | |_) / _ \/ __/ _ \| '__/ _` | | |   / _ \ / _` |
+ |  _ <  __/ (_| (_) | | | (_| | | |__| (_) | (_| |
+ |_| \_\___|\___\___/|_|  \__,_| |_____\___/ \__, |
+                                             |___/
+ RecordLog classes, a memory-mapped segmented log of timestamped messages
+*/
+
+#ifndef RECORD_LOG_HPP
+#define RECORD_LOG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*!
+ * Segmented log of timestamped records, with a timestamp index
+ *
+ * A log is a directory of segment files (`%016llu.log`), each written
+ * through a memory mapping of `segment_size` bytes and truncated to its
+ * actual length when closed. Each record is a 32-byte header (length,
+ * topic/format/data/blob lengths, timestamp in ns) followed by topic, blob
+ * format, data and blob, padded to 8 bytes. As in the Spool, the length is
+ * written last, so a partially written record is never read back.
+ *
+ * Each segment has an index file (`%016llu.idx`) with a (timestamp, offset)
+ * pair per record, used to seek by timestamp with a binary search. Records
+ * are expected in non-decreasing timestamp order.
+ */
+namespace RecordLog {
+
+struct Record {
+  int64_t timestamp = 0; // ns
+  std::string topic;
+  std::string blob_format;
+  std::string data;
+  std::vector<unsigned char> blob;
+};
+
+struct Header {
+  uint32_t length; // total, excluding padding
+  uint32_t topic_len;
+  uint32_t format_len;
+  uint32_t data_len;
+  uint32_t blob_len;
+  uint32_t reserved;
+  int64_t timestamp;
+};
+static_assert(sizeof(Header) == 32, "Unexpected RecordLog header size");
+
+struct IndexEntry {
+  int64_t timestamp;
+  uint64_t offset;
+};
+
+inline size_t padded(size_t len) { return (len + 7) & ~size_t(7); }
+
+inline std::filesystem::path segment_path(const std::filesystem::path &dir, uint64_t index,
+                                          const char *ext) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llu.%s", static_cast<unsigned long long>(index), ext);
+  return dir / name;
+}
+
+// Sorted indexes of the segments in a log directory
+inline std::vector<uint64_t> segments(const std::filesystem::path &dir) {
+  std::vector<uint64_t> list;
+  if (!std::filesystem::exists(dir)) return list;
+  for (auto &entry : std::filesystem::directory_iterator(dir)) {
+    std::string stem = entry.path().stem().string();
+    // other files in the directory are ignored
+    if (entry.path().extension() != ".log" || stem.empty() || stem.size() > 19 ||
+        stem.find_first_not_of("0123456789") != std::string::npos)
+      continue;
+    list.push_back(std::stoull(stem));
+  }
+  std::sort(list.begin(), list.end());
+  return list;
+}
+
+/*!
+ * Appends records to a log. A new segment is started at each opening.
+ */
+class Writer {
+public:
+  Writer(std::filesystem::path dir, size_t segment_size = 64 << 20)
+      : _dir(dir), _segment_size(padded(segment_size)) {
+    std::filesystem::create_directories(_dir);
+    auto list = segments(_dir);
+    _index = list.empty() ? 0 : list.back() + 1;
+    open();
+  }
+
+  ~Writer() { close(); }
+
+  Writer(const Writer &) = delete;
+  Writer &operator=(const Writer &) = delete;
+
+  /*!
+   * Appends a record. Returns false if it is larger than a segment.
+   */
+  bool append(int64_t timestamp, const std::string &topic, const std::string &data,
+              const unsigned char *blob = nullptr, size_t blob_len = 0,
+              const std::string &blob_format = "") {
+    size_t len = sizeof(Header) + topic.size() + blob_format.size() + data.size() + blob_len;
+    if (padded(len) > _segment_size) return false;
+    if (_pos + padded(len) > _segment_size) {
+      close();
+      _index++;
+      open();
+    }
+    uint8_t *rec = _base + _pos;
+    Header h = {0, uint32_t(topic.size()), uint32_t(blob_format.size()), uint32_t(data.size()),
+                uint32_t(blob_len), 0, timestamp};
+    uint8_t *p = rec + sizeof(Header);
+    std::memcpy(p, topic.data(), topic.size());
+    p += topic.size();
+    std::memcpy(p, blob_format.data(), blob_format.size());
+    p += blob_format.size();
+    std::memcpy(p, data.data(), data.size());
+    p += data.size();
+    if (blob_len) std::memcpy(p, blob, blob_len);
+    std::memcpy(rec + sizeof(uint32_t), reinterpret_cast<uint8_t *>(&h) + sizeof(uint32_t),
+                sizeof(Header) - sizeof(uint32_t));
+    std::atomic_thread_fence(std::memory_order_release);
+    uint32_t l = static_cast<uint32_t>(len);
+    std::memcpy(rec, &l, sizeof(l));
+    IndexEntry e = {timestamp, _pos};
+    fwrite(&e, sizeof(e), 1, _idx);
+    _pos += padded(len);
+    _records++;
+    _bytes += len;
+    return true;
+  }
+
+  /*!
+   * Flushes the index, and the segment to disk if `sync` is true
+   */
+  void flush(bool sync = false) {
+    if (_idx) fflush(_idx);
+    if (sync && _base) msync(_base, _pos, MS_SYNC);
+  }
+
+  size_t records() const { return _records; }
+  size_t bytes() const { return _bytes; }
+  uint64_t segment() const { return _index; }
+
+private:
+  void open() {
+    auto path = segment_path(_dir, _index, "log");
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ::ftruncate(fd, _segment_size) != 0)
+      throw std::runtime_error("Cannot create log segment " + path.string());
+    void *p = ::mmap(nullptr, _segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) throw std::runtime_error("Cannot map log segment " + path.string());
+    _base = static_cast<uint8_t *>(p);
+    _pos = 0;
+    _idx = fopen(segment_path(_dir, _index, "idx").c_str(), "wb");
+    if (!_idx) throw std::runtime_error("Cannot create log index in " + _dir.string());
+  }
+
+  // Unmaps the segment and truncates it to its length; an empty segment is
+  // removed, together with its index
+  void close() {
+    if (_idx) fclose(_idx);
+    _idx = nullptr;
+    if (!_base) return;
+    ::munmap(_base, _segment_size);
+    _base = nullptr;
+    if (_pos == 0) {
+      std::error_code ec;
+      std::filesystem::remove(segment_path(_dir, _index, "log"), ec);
+      std::filesystem::remove(segment_path(_dir, _index, "idx"), ec);
+      return;
+    }
+    std::filesystem::resize_file(segment_path(_dir, _index, "log"), _pos);
+  }
+
+  std::filesystem::path _dir;
+  size_t _segment_size;
+  uint64_t _index = 0;
+  uint8_t *_base = nullptr;
+  uint64_t _pos = 0;
+  FILE *_idx = nullptr;
+  size_t _records = 0, _bytes = 0;
+};
+
+/*!
+ * Reads records from a log, sequentially or from a timestamp
+ */
+class Reader {
+  struct Mapping {
+    const uint8_t *base = nullptr;
+    size_t size = 0;
+  };
+
+public:
+  Reader(std::filesystem::path dir) : _dir(dir), _segments(segments(dir)) {
+    if (_segments.empty()) throw std::runtime_error("No log segments in " + _dir.string());
+    load(0);
+  }
+
+  ~Reader() {
+    unmap(_log);
+    unmap(_idx);
+  }
+
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  /*!
+   * Reads the next record. Returns false at the end of the log, or at a
+   * corrupt record (see error()).
+   */
+  bool next(Record &r) {
+    while (true) {
+      if (_pos + sizeof(Header) <= _log.size) {
+        Header h;
+        std::memcpy(&h, _log.base + _pos, sizeof(h));
+        if (h.length != 0) {
+          uint64_t fields = uint64_t(h.topic_len) + h.format_len + h.data_len + h.blob_len;
+          if (_pos + h.length > _log.size || fields + sizeof(Header) != h.length) {
+            _error = "Corrupt record at offset " + std::to_string(_pos) + " of " +
+                     segment_path(_dir, _segments[_current], "log").string();
+            return false;
+          }
+          const char *p = reinterpret_cast<const char *>(_log.base + _pos + sizeof(Header));
+          r.timestamp = h.timestamp;
+          r.topic.assign(p, h.topic_len);
+          p += h.topic_len;
+          r.blob_format.assign(p, h.format_len);
+          p += h.format_len;
+          r.data.assign(p, h.data_len);
+          p += h.data_len;
+          r.blob.assign(p, p + h.blob_len);
+          _pos += padded(h.length);
+          return true;
+        }
+      }
+      if (_current + 1 >= _segments.size()) return false;
+      load(_current + 1);
+    }
+  }
+
+  /*!
+   * Moves to the first record with a timestamp not less than `timestamp`
+   */
+  void seek(int64_t timestamp) {
+    // last segment starting at or before the timestamp; empty segments
+    // (left by a crash, or still being written) have no timestamp, so the
+    // search probes the first non-empty one from the middle
+    size_t lo = 0, hi = _segments.size();
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2, probe = mid;
+      int64_t t = 0;
+      for (; probe < hi; probe++) {
+        load(probe);
+        if (first_timestamp(t)) break;
+      }
+      if (probe < hi && t <= timestamp) lo = probe; else hi = mid;
+    }
+    load(lo);
+    const IndexEntry *begin = reinterpret_cast<const IndexEntry *>(_idx.base);
+    const IndexEntry *end = begin + _idx.size / sizeof(IndexEntry);
+    const IndexEntry *it = std::lower_bound(begin, end, timestamp,
+      [](const IndexEntry &e, int64_t t) { return e.timestamp < t; });
+    if (it != end) {
+      _pos = it->offset;
+    } else if (lo + 1 < _segments.size()) {
+      load(lo + 1);
+    } else {
+      _pos = _log.size; // past the end
+    }
+  }
+
+  /*!
+   * Moves to the first record
+   */
+  void rewind() { load(0); }
+
+  /*!
+   * Timestamp of the first record of the log (0 if empty)
+   */
+  int64_t start_timestamp() {
+    size_t current = _current;
+    uint64_t pos = _pos;
+    int64_t t = 0;
+    for (size_t i = 0; i < _segments.size(); i++) {
+      load(i);
+      if (first_timestamp(t)) break;
+    }
+    load(current);
+    _pos = pos;
+    return t;
+  }
+
+  size_t segment_count() const { return _segments.size(); }
+
+  /*!
+   * Error that stopped next(), empty at the end of the log
+   */
+  std::string error() const { return _error; }
+
+private:
+  // Timestamp of the first record of the current segment; false if it has none
+  bool first_timestamp(int64_t &t) const {
+    if (_idx.size >= sizeof(IndexEntry)) {
+      t = reinterpret_cast<const IndexEntry *>(_idx.base)->timestamp;
+      return true;
+    }
+    if (_log.size < sizeof(Header)) return false;
+    const Header *h = reinterpret_cast<const Header *>(_log.base);
+    if (h->length == 0) return false;
+    t = h->timestamp;
+    return true;
+  }
+
+  void load(size_t i) {
+    if (!_log.base || i != _current) {
+      unmap(_log);
+      unmap(_idx);
+      _log = map(segment_path(_dir, _segments[i], "log"));
+      _idx = map(segment_path(_dir, _segments[i], "idx"));
+      _current = i;
+    }
+    _pos = 0;
+    _error.clear();
+  }
+
+  static Mapping map(const std::filesystem::path &path) {
+    Mapping m;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return m;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      void *p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        m.base = static_cast<const uint8_t *>(p);
+        m.size = st.st_size;
+        ::madvise(p, m.size, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+    return m;
+  }
+
+  static void unmap(Mapping &m) {
+    if (m.base) ::munmap(const_cast<uint8_t *>(m.base), m.size);
+    m = Mapping();
+  }
+
+  std::filesystem::path _dir;
+  std::vector<uint64_t> _segments;
+  size_t _current = 0;
+  Mapping _log, _idx;
+  uint64_t _pos = 0;
+  std::string _error;
+};
+
+} // namespace RecordLog
+
+#endif // RECORD_LOG_HPP
@@ -0,0 +1,83 @@
+/*
+  ____            _     _
+ |  _ \ ___  __ _(_)___| |_ _ __ _   _
+ | |_) / _ \/ _` | / __| __| '__| | | |
+ |  _ <  __/ (_| | \__ \ |_| |  | |_| |
+ |_| \_\___|\__, |_|___/\__|_|   \__, |
+            |___/                |___/
+ Registry class, holding the drivers of plugins built into the executable
+*/
+
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+#include <pugg/Kernel.h>
+#include <string>
+#include <vector>
+
+/*!
+ * Static registry of built-in plugins
+ *
+ * With the `MADS_STATIC_PLUGINS` CMake option, plugins are also compiled
+ * into the `*_static` loaders. In that case, the INSTALL_*_DRIVER macros
+ * do not define the `register_pugg_plugin()` entry point, but add a
+ * registrar to this registry, at static initialization. Hosts then call
+ * install() to add the built-in drivers to their pugg::Kernel, and find them
+ * with `get_driver()`/`get_all_drivers()` as if they had been loaded from
+ * `.plugin` files.
+ */
+class Registry {
+public:
+  using Installer = void (*)(pugg::Kernel *kernel);
+
+  struct Entry {
+    std::string server; // e.g. FilterServer
+    std::string name;   // the plugin name
+    Installer install;
+  };
+
+  /*!
+   * Adds an entry at static initialization
+   */
+  struct Registrar {
+    Registrar(const std::string &server, const std::string &name, Installer install) {
+      entries().push_back({server, name, install});
+    }
+  };
+
+  /*!
+   * The built-in plugins
+   */
+  static std::vector<Entry> &entries() {
+    static std::vector<Entry> list;
+    return list;
+  }
+
+  /*!
+   * Adds the built-in drivers for `server` to the kernel: all of them, or
+   * those of the plugin named `name`. Returns the number of drivers added.
+   */
+  static size_t install(pugg::Kernel &kernel, const std::string &server,
+                        const std::string &name = "") {
+    size_t n = 0;
+    for (auto &e : entries()) {
+      if (e.server != server || (!name.empty() && e.name != name)) continue;
+      e.install(&kernel);
+      n++;
+    }
+    return n;
+  }
+
+  /*!
+   * Names of the built-in plugins for a server
+   */
+  static std::vector<std::string> names(const std::string &server) {
+    std::vector<std::string> list;
+    for (auto &e : entries()) {
+      if (e.server == server) list.push_back(e.name);
+    }
+    return list;
+  }
+};
+
+#endif // REGISTRY_HPP
@@ -0,0 +1,446 @@
+/*
+  ____  _                        _   ____        _            _
+ / ___|| |__   __ _ _ __ ___  __| | |  _ \  __ _| |_ __ _ ___| |_ ___  _ __ ___
+ \___ \| '_ \ / _` | '__/ _ \/ _` | | | | |/ _` | __/ _` / __| __/ _ \| '__/ _ \
+  ___) | | | | (_| | | |  __/ (_| | | |_| | (_| | || (_| \__ \ || (_) | | |  __/
+ |____/|_| |_|\__,_|_|  \___|\__,_| |____/ \__,_|\__\__,_|___/\__\___/|_|  \___|
+
+ SharedDatastore class, a JSON store shared by the agents on the same node
+*/
+
+#ifndef SHARED_DATASTORE_HPP
+#define SHARED_DATASTORE_HPP
+
+#include <nlohmann/json.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/*!
+ * JSON store shared among processes through a memory-mapped file
+ *
+ * The file (`$TMPDIR/mads/<name>.shm` by default) holds a header and two
+ * slots, each with a MessagePack encoding of the whole store. Writers are
+ * serialized with `flock()`: a writer encodes the new state in the inactive
+ * slot, then publishes it by switching the active slot and incrementing the
+ * version counter. A crashed writer thus never leaves a torn state behind.
+ *
+ * Readers take no lock: each slot has a sequence number, odd while a writer
+ * is filling it, and readers copy the active slot and retry if its sequence
+ * number was odd or changed meanwhile (a seqlock). The parsed state is
+ * cached and shared until the version changes, so repeated reads cost no
+ * parsing.
+ *
+ * Changes are notified with a futex on the version counter on Linux, and by
+ * polling elsewhere. Callbacks registered with watch() are called from a
+ * background thread with the new value of the top-level key, when it changes.
+ *
+ * Instances are thread safe.
+ */
+class SharedDatastore {
+  struct Header {
+    uint64_t magic;
+    uint32_t layout;
+    std::atomic<uint32_t> futex;   // low 32 bits of version, for waiting
+    std::atomic<uint64_t> version; // number of commits
+    std::atomic<uint32_t> active;  // slot holding the current state
+    uint32_t reserved;
+    std::atomic<uint64_t> offset[2];
+    std::atomic<uint64_t> capacity[2];
+    std::atomic<uint64_t> length[2];
+    std::atomic<uint64_t> seq[2];  // odd while the slot is being written
+  };
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "SharedDatastore needs lock-free 64-bit atomics");
+  static constexpr uint64_t MAGIC = 0x5344534441444d00ULL; // "\0MADSDSS"
+  static constexpr uint32_t LAYOUT = 1;
+  static constexpr size_t HEADER_SIZE = 128;
+  static_assert(sizeof(Header) <= HEADER_SIZE, "SharedDatastore header too large");
+
+public:
+  using Callback = std::function<void(const std::string &key, const nlohmann::json &value)>;
+
+  SharedDatastore() {}
+
+  ~SharedDatastore() {
+    stop_watcher();
+    std::lock_guard<std::mutex> lock(_mtx);
+    close();
+  }
+
+  SharedDatastore(const SharedDatastore &) = delete;
+  SharedDatastore &operator=(const SharedDatastore &) = delete;
+
+  /*!
+   * Opens (creating it if needed) the shared store `name`, in `$TMPDIR/mads`
+   * or in the given file path. `capacity` is the initial size of each slot.
+   */
+  void prepare(const std::string &name, std::filesystem::path path = "",
+               size_t capacity = 64 << 10) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    close();
+    _path = path.empty() ? std::filesystem::temp_directory_path() / "mads" / (name + ".shm") : path;
+    std::filesystem::create_directories(_path.parent_path());
+    _fd = ::open(_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd < 0) throw std::runtime_error("Cannot open shared datastore " + _path.string());
+    ::flock(_fd, LOCK_EX);
+    try {
+      map_header();
+      if (header()->magic != MAGIC) {
+        // first user (or a crash during the first preparation): lay out an
+        // empty store
+        capacity = std::max<size_t>(capacity, 64);
+        if (::ftruncate(_fd, HEADER_SIZE + 2 * capacity) != 0)
+          throw std::runtime_error("Cannot size shared datastore " + _path.string());
+        remap();
+        Header *h = header();
+        h->layout = LAYOUT;
+        h->reserved = 0;
+        h->futex = 0;
+        h->version = 0;
+        h->active = 0;
+        for (int i = 0; i < 2; i++) {
+          h->offset[i] = HEADER_SIZE + i * capacity;
+          h->capacity[i] = capacity;
+          h->length[i] = 0;
+          h->seq[i] = 0;
+        }
+        std::vector<uint8_t> empty = nlohmann::json::to_msgpack(nlohmann::json::object());
+        std::memcpy(_base + HEADER_SIZE, empty.data(), empty.size());
+        h->length[0] = empty.size();
+        std::atomic_thread_fence(std::memory_order_release);
+        h->magic = MAGIC;
+      } else if (header()->layout != LAYOUT) {
+        throw std::runtime_error("Unsupported shared datastore layout in " + _path.string());
+      }
+      remap();
+    } catch (...) {
+      ::flock(_fd, LOCK_UN);
+      close();
+      throw;
+    }
+    ::flock(_fd, LOCK_UN);
+    _cache.reset();
+    _cached_version = UINT64_MAX;
+  }
+
+  /*!
+   * Current state. The parsed state is shared until the next change, so
+   * calling this repeatedly is cheap. If the published state cannot be
+   * decoded (a damaged or foreign file), the last good state is returned, or
+   * std::runtime_error is thrown if there is none.
+   */
+  std::shared_ptr<const nlohmann::json> read() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return read_locked();
+  }
+
+  /*!
+   * Value of a top-level key, or null if missing
+   */
+  nlohmann::json get(const std::string &key) {
+    auto data = read();
+    auto it = data->find(key);
+    return it == data->end() ? nlohmann::json() : *it;
+  }
+
+  /*!
+   * Atomically modifies the state with `fn`, which gets the current state.
+   * Writers in all processes are serialized.
+   */
+  void update(const std::function<void(nlohmann::json &)> &fn) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!_base) throw std::runtime_error("Shared datastore not prepared");
+    ::flock(_fd, LOCK_EX);
+    try {
+      nlohmann::json data = *read_locked();
+      fn(data);
+      commit(data);
+    } catch (...) {
+      ::flock(_fd, LOCK_UN);
+      throw;
+    }
+    ::flock(_fd, LOCK_UN);
+    wake();
+  }
+
+  void set(const std::string &key, const nlohmann::json &value) {
+    update([&](nlohmann::json &data) { data[key] = value; });
+  }
+
+  void erase(const std::string &key) {
+    update([&](nlohmann::json &data) { data.erase(key); });
+  }
+
+  /*!
+   * Number of changes committed so far, by any process
+   */
+  uint64_t version() const {
+    return _header ? header()->version.load(std::memory_order_acquire) : 0;
+  }
+
+  /*!
+   * Waits until the version differs from `version`, or the timeout expires.
+   * Returns the current version, or 0 right away if not prepared.
+   */
+  uint64_t wait(uint64_t version, std::chrono::milliseconds timeout) {
+    if (!_header) return 0;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    uint64_t v;
+    while ((v = this->version()) == version) {
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::steady_clock::duration::zero()) break;
+#ifdef __linux__
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+      struct timespec ts = {static_cast<time_t>(ns / 1000000000), static_cast<long>(ns % 1000000000)};
+      // shared futex: the mapping is shared among processes
+      syscall(SYS_futex, &header()->futex, FUTEX_WAIT, static_cast<uint32_t>(version), &ts,
+              nullptr, 0);
+#else
+      std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+        left, std::chrono::milliseconds(10)));
+#endif
+    }
+    return v;
+  }
+
+  /*!
+   * Calls `cb` from a background thread each time the value of the top-level
+   * `key` changes, in any process. Exceptions thrown by `cb` are reported on
+   * stderr and do not stop the watcher.
+   */
+  void watch(const std::string &key, Callback cb) {
+    if (!_header) throw std::runtime_error("Shared datastore not prepared");
+    std::lock_guard<std::mutex> lock(_watch_mtx);
+    _watchers[key].push_back(std::move(cb));
+    // a callback may call watch() while the destructor stops the watcher
+    if (!_watcher.joinable() && !_stopped) {
+      _watching = true;
+      _watcher = std::thread(&SharedDatastore::watch_loop, this);
+    }
+  }
+
+  std::filesystem::path path() const { return _path; }
+
+private:
+  Header *header() const { return _header; }
+
+  // The header has its own mapping, which stays valid when the file grows,
+  // so that the version can be read and waited on without locking
+  void map_header() {
+    struct stat st;
+    ::fstat(_fd, &st);
+    if (static_cast<size_t>(st.st_size) < HEADER_SIZE && ::ftruncate(_fd, HEADER_SIZE) != 0)
+      throw std::runtime_error("Cannot size shared datastore " + _path.string());
+    void *p = ::mmap(nullptr, HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (p == MAP_FAILED) throw std::runtime_error("Cannot map shared datastore " + _path.string());
+    _header = static_cast<Header *>(p);
+  }
+
+  // Maps the whole file, which only grows. Call with _mtx locked.
+  void remap() {
+    struct stat st;
+    ::fstat(_fd, &st);
+    size_t size = st.st_size;
+    if (_base && size == _size) return;
+    if (_base) ::munmap(_base, _size);
+    void *p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (p == MAP_FAILED) {
+      _base = nullptr;
+      throw std::runtime_error("Cannot map shared datastore " + _path.string());
+    }
+    _base = static_cast<uint8_t *>(p);
+    _size = size;
+  }
+
+  void close() {
+    if (_header) ::munmap(_header, HEADER_SIZE);
+    _header = nullptr;
+    if (_base) ::munmap(_base, _size);
+    if (_fd >= 0) ::close(_fd);
+    _base = nullptr;
+    _fd = -1;
+    _size = 0;
+  }
+
+  // Call with _mtx locked
+  std::shared_ptr<const nlohmann::json> read_locked() {
+    if (!_base) throw std::runtime_error("Shared datastore not prepared");
+    std::vector<uint8_t> buffer;
+    while (true) {
+      Header *h = header();
+      uint64_t v1 = h->version.load(std::memory_order_acquire);
+      if (v1 == _cached_version && _cache) return _cache;
+      uint32_t slot = h->active.load(std::memory_order_acquire) & 1;
+      uint64_t s1 = h->seq[slot].load(std::memory_order_acquire);
+      // a failed read is retried only if a writer got in the way; otherwise
+      // the active slot is damaged
+      auto damaged = [&]() {
+        return h->version.load(std::memory_order_acquire) == v1 &&
+               h->seq[slot].load(std::memory_order_acquire) == s1;
+      };
+      if (s1 & 1) {
+        if (damaged()) return fallback();
+        continue; // a writer got there first
+      }
+      uint64_t offset = h->offset[slot].load(std::memory_order_acquire);
+      uint64_t length = h->length[slot].load(std::memory_order_acquire);
+      if (offset + length > _size) {
+        remap(); // grown by another process
+        if (offset + length > _size && damaged()) return fallback();
+        continue;
+      }
+      buffer.assign(_base + offset, _base + offset + length);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (h->seq[slot].load(std::memory_order_relaxed) != s1) continue; // slot rewritten
+      nlohmann::json data = nlohmann::json::from_msgpack(buffer, true, false);
+      if (data.is_discarded()) {
+        if (damaged()) return fallback();
+        continue;
+      }
+      _cache = std::make_shared<const nlohmann::json>(std::move(data));
+      _cached_version = v1;
+      return _cache;
+    }
+  }
+
+  // The last good state when the active slot cannot be decoded, e.g. in a
+  // damaged or foreign file
+  std::shared_ptr<const nlohmann::json> fallback() {
+    if (_cache) return _cache;
+    throw std::runtime_error("Shared datastore " + _path.string() + " is damaged");
+  }
+
+  // Publishes a new state. Call with _mtx and the file lock held.
+  void commit(const nlohmann::json &data) {
+    std::vector<uint8_t> bin = nlohmann::json::to_msgpack(data);
+    Header *h = header();
+    uint32_t slot = 1 - h->active.load(std::memory_order_acquire);
+    // odd sequence number while writing, even if a previous writer crashed
+    uint64_t seq = h->seq[slot].load(std::memory_order_relaxed);
+    seq += (seq & 1) ? 2 : 1;
+    h->seq[slot].store(seq, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (bin.size() > h->capacity[slot]) {
+      // a larger slot at the end of the file; the old space is abandoned
+      uint64_t capacity = std::max<uint64_t>(bin.size(), 2 * h->capacity[slot]);
+      uint64_t offset = _size;
+      if (::ftruncate(_fd, offset + capacity) != 0)
+        throw std::runtime_error("Cannot grow shared datastore " + _path.string());
+      remap();
+      h->offset[slot].store(offset, std::memory_order_release);
+      h->capacity[slot].store(capacity, std::memory_order_release);
+    }
+    std::memcpy(_base + h->offset[slot], bin.data(), bin.size());
+    h->length[slot].store(bin.size(), std::memory_order_release);
+    h->seq[slot].store(seq + 1, std::memory_order_release);
+    h->active.store(slot, std::memory_order_release);
+    uint64_t v = h->version.fetch_add(1, std::memory_order_acq_rel) + 1;
+    h->futex.store(static_cast<uint32_t>(v), std::memory_order_release);
+    _cache = std::make_shared<const nlohmann::json>(data);
+    _cached_version = v;
+  }
+
+  void wake() {
+#ifdef __linux__
+    syscall(SYS_futex, &header()->futex, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  // Nothing may escape the watcher thread: a state that cannot be read (a
+  // damaged store) is skipped until the next change, and a failing callback
+  // is reported
+  void watch_loop() {
+    uint64_t version = this->version();
+    std::shared_ptr<const nlohmann::json> last = try_read();
+    while (_watching) {
+      uint64_t v = wait(version, std::chrono::milliseconds(100));
+      if (v == version) continue;
+      version = v;
+      std::shared_ptr<const nlohmann::json> now = try_read();
+      if (!now) continue;
+      if (!last) {
+        last = now;
+        continue;
+      }
+      // callbacks are called without the lock, so that they can call watch()
+      std::map<std::string, std::vector<Callback>> watchers;
+      {
+        std::lock_guard<std::mutex> lock(_watch_mtx);
+        watchers = _watchers;
+      }
+      for (auto &[key, callbacks] : watchers) {
+        auto a = last->find(key), b = now->find(key);
+        bool was = a != last->end(), is = b != now->end();
+        if (was == is && (!is || *a == *b)) continue;
+        for (auto &cb : callbacks) {
+          try {
+            cb(key, is ? *b : nlohmann::json());
+          } catch (std::exception &e) {
+            std::cerr << "SharedDatastore: watcher of " << key << ": " << e.what() << std::endl;
+          } catch (...) {
+            std::cerr << "SharedDatastore: watcher of " << key << " failed" << std::endl;
+          }
+        }
+      }
+      last = now;
+    }
+  }
+
+  std::shared_ptr<const nlohmann::json> try_read() {
+    try {
+      return read();
+    } catch (std::exception &e) {
+      std::cerr << "SharedDatastore: " << e.what() << std::endl;
+      return nullptr;
+    }
+  }
+
+  void stop_watcher() {
+    std::thread watcher;
+    {
+      std::lock_guard<std::mutex> lock(_watch_mtx);
+      _watching = false;
+      _stopped = true;
+      watcher = std::move(_watcher);
+    }
+    if (watcher.joinable()) watcher.join();
+  }
+
+  std::filesystem::path _path;
+  int _fd = -1;
+  Header *_header = nullptr;
+  uint8_t *_base = nullptr;
+  size_t _size = 0;
+  std::shared_ptr<const nlohmann::json> _cache;
+  uint64_t _cached_version = UINT64_MAX;
+  std::mutex _mtx;
+  std::mutex _watch_mtx;
+  std::map<std::string, std::vector<Callback>> _watchers;
+  std::thread _watcher;
+  std::atomic<bool> _watching{false};
+  bool _stopped = false;
+};
+
+#endif // SHARED_DATASTORE_HPP
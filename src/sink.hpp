@@ -14,8 +14,10 @@ Base class for sink plugins
 #include <string>
 #include <vector>
 #include <map>
+#include <type_traits>
 #include <nlohmann/json.hpp>
 #include "common.hpp"
+#include "timestamps.hpp"
 
 #ifdef _WIN32
 #define EXPORTIT __declspec(dllexport)
@@ -80,8 +82,40 @@ public:
    */
   virtual void set_params(const nlohmann::json &params){
     _agent_id = params.value("agent_id", "");
+    _timestamps = params.value("timestamps", false);
   };
 
+  /*!
+   * Stamps the arrival time of the input data
+   *
+   * When the `timestamps` parameter is true, this adds to the input, in
+   * place, a final hop in its `timestamps` array, holding the arrival time;
+   * otherwise, the input is not touched (and not copied). Agents call it
+   * right before load_data().
+   *
+   * @param in The input data
+   */
+  void stamp_arrival(Tin &in) {
+    if constexpr (std::is_same_v<Tin, nlohmann::json>) {
+      if (_timestamps && in.is_object()) Timestamps::arrive(in, kind());
+    }
+  }
+
+  /*!
+   * Decomposes the end-to-end latency of stamped data into per-hop transit
+   * and processing times (see Timestamps::latency())
+   *
+   * @param in The stamped input data
+   * @return The latency segments and total, in ms
+   */
+  nlohmann::json latency(Tin const &in) {
+    if constexpr (std::is_same_v<Tin, nlohmann::json>) {
+      return Timestamps::latency(in);
+    } else {
+      return nlohmann::json::object();
+    }
+  }
+
   /*!
    * Returns the sink information
    *
@@ -120,6 +154,7 @@ protected:
   std::string _error;
   std::string _agent_id;
   nlohmann::json _params;
+  bool _timestamps = false;
 };
 
 #ifndef HAVE_MAIN
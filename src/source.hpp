@@ -7,16 +7,18 @@
                                  
 Base class for source plugins
 */
-#ifndef FILTER_HPP
-#define FILTER_HPP
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
 
 #include <iostream>
 #include <string>
 #include <vector>
 #include <map>
+#include <type_traits>
 #include <chrono>
 #include <nlohmann/json.hpp>
 #include "common.hpp"
+#include "timestamps.hpp"
 
 #ifdef _WIN32
 #define EXPORTIT __declspec(dllexport)
@@ -43,7 +45,7 @@ Base class for source plugins
 template <typename Tout = std::vector<double>>
 class Source {
 public:
-  Source() : _blob_format("none"), _error("No error"), _agent_id("") {}
+  Source() : next_loop_duration(0), _blob_format("none"), _error("No error"), _agent_id("") {}
   virtual ~Source() {}
 
   /*!
@@ -83,8 +85,25 @@ public:
    */
   virtual void set_params(const nlohmann::json &params){
     _agent_id = params.value("agent_id", "");
+    _timestamps = params.value("timestamps", false);
   };
 
+  /*!
+   * Stamps the departure time of the output data
+   *
+   * When the `timestamps` parameter is true, this adds a hop to the
+   * `timestamps` array of the output, with the current time on the steady,
+   * system and (where available) TAI clocks. Agents call it right after
+   * get_output(); it does nothing for non-JSON outputs.
+   *
+   * @param out The output data
+   */
+  void stamp(Tout &out) {
+    if constexpr (std::is_same_v<Tout, nlohmann::json>) {
+      if (_timestamps && out.is_object()) Timestamps::depart(out, kind());
+    }
+  }
+
   /*!
    * Returns the filter information
    *
@@ -124,6 +143,9 @@ public:
   
   /*!
    * The desired duration of current loop iteration
+   *
+   * Sources can set it in get_output() to change the loop period from the
+   * next iteration on; zero (the default) means no change.
    */
   std::chrono::duration<long long, std::milli> next_loop_duration;
 
@@ -132,6 +154,7 @@ protected:
   std::string _blob_format;
   std::string _error;
   std::string _agent_id;
+  bool _timestamps = false;
 };
 
 #ifndef HAVE_MAIN
@@ -149,4 +172,4 @@ public:
 
 #endif
 
-#endif // FILTER_HPP
\ No newline at end of file
+#endif // SOURCE_HPP
\ No newline at end of file
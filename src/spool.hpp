@@ -0,0 +1,233 @@
+/*
+  ____                    _
+ / ___| _ __   ___   ___ | |
+ \___ \| '_ \ / _ \ / _ \| |
+  ___) | |_) | (_) | (_) | |
+ |____/| .__/ \___/ \___/|_|
+       |_|
+ Spool class, a disk-backed FIFO of messages for store-and-forward
+*/
+
+#ifndef SPOOL_HPP
+#define SPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*!
+ * Disk-backed, append-only FIFO of (topic, payload) records
+ *
+ * Records are appended to memory-mapped segment files of fixed size in a
+ * spool directory. Consumed segments are deleted, and the read position is
+ * persisted in a memory-mapped offset file, so that the spool survives
+ * restarts. Disk usage is bounded: when `max_size` would be exceeded, the
+ * oldest segment is dropped.
+ *
+ * Each record is an 8-byte header (total length, topic length) followed by
+ * topic and payload, padded to 8 bytes. The header is written last, so a
+ * partially written record is never read back.
+ *
+ * The class is not thread safe.
+ */
+class Spool {
+  struct Segment {
+    uint64_t index = 0;
+    uint8_t *base = nullptr;
+  };
+
+public:
+  Spool(std::filesystem::path dir, size_t segment_size = 16 << 20,
+        size_t max_size = 1 << 30)
+      : _dir(dir), _segment_size(segment_size & ~size_t(7)),
+        _max_segments(std::max<size_t>(2, max_size / segment_size)) {
+    std::filesystem::create_directories(_dir);
+    for (auto &entry : std::filesystem::directory_iterator(_dir)) {
+      if (entry.path().extension() == ".seg")
+        _segments.push_back(std::stoull(entry.path().stem().string()));
+    }
+    std::sort(_segments.begin(), _segments.end());
+    if (_segments.empty()) _segments.push_back(0);
+
+    // Read position
+    int fd = ::open((_dir / "read.offset").c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ::ftruncate(fd, 2 * sizeof(uint64_t)) != 0)
+      throw std::runtime_error("Cannot open spool offset file in " + _dir.string());
+    void *p = ::mmap(nullptr, 2 * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Cannot map spool offset file in " + _dir.string());
+    _offset = static_cast<uint64_t *>(p);
+    if (_offset[0] < _segments.front() || _offset[0] > _segments.back()) {
+      _offset[0] = _segments.front();
+      _offset[1] = 0;
+    }
+    while (_segments.front() < _offset[0]) {
+      std::filesystem::remove(path(_segments.front()));
+      _segments.pop_front();
+    }
+
+    // Write position: first empty header in the last segment
+    _write.index = _segments.back();
+    _write.base = map(_write.index);
+    _write_pos = 0;
+    while (_write_pos + 8 <= _segment_size && length(_write.base + _write_pos) != 0)
+      _write_pos += record_size(length(_write.base + _write_pos));
+    if (_offset[0] == _write.index) {
+      _read = _write;
+    } else {
+      _read.index = _offset[0];
+      _read.base = map(_read.index);
+    }
+  }
+
+  ~Spool() {
+    if (_read.base != _write.base) unmap(_read);
+    unmap(_write);
+    ::munmap(_offset, 2 * sizeof(uint64_t));
+  }
+
+  Spool(const Spool &) = delete;
+  Spool &operator=(const Spool &) = delete;
+
+  /*!
+   * Appends a record. Returns false if the record is larger than a segment.
+   */
+  bool push(const std::string &topic, const std::string &payload) {
+    uint32_t len = static_cast<uint32_t>(topic.size() + payload.size());
+    size_t size = record_size(len);
+    if (size > _segment_size) return false;
+    if (_write_pos + size > _segment_size) roll();
+    uint8_t *rec = _write.base + _write_pos;
+    std::memcpy(rec + 8, topic.data(), topic.size());
+    std::memcpy(rec + 8 + topic.size(), payload.data(), payload.size());
+    uint32_t topic_len = static_cast<uint32_t>(topic.size());
+    std::memcpy(rec + 4, &topic_len, 4);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(rec, &len, 4);
+    _write_pos += size;
+    _pushed++;
+    return true;
+  }
+
+  /*!
+   * Reads the oldest record without removing it. Returns false if empty.
+   */
+  bool front(std::string &topic, std::string &payload) {
+    if (!advance()) return false;
+    const uint8_t *rec = _read.base + _offset[1];
+    uint32_t len = length(rec), topic_len;
+    std::memcpy(&topic_len, rec + 4, 4);
+    topic.assign(reinterpret_cast<const char *>(rec + 8), topic_len);
+    payload.assign(reinterpret_cast<const char *>(rec + 8 + topic_len), len - topic_len);
+    return true;
+  }
+
+  /*!
+   * Removes the oldest record, persisting the new read position
+   */
+  void pop() {
+    if (!advance()) return;
+    _offset[1] += record_size(length(_read.base + _offset[1]));
+    _popped++;
+  }
+
+  bool empty() { return !advance(); }
+
+  /*!
+   * Approximate disk usage, in bytes
+   */
+  size_t disk_usage() const { return _segments.size() * _segment_size; }
+
+  size_t pushed() const { return _pushed; }
+  size_t popped() const { return _popped; }
+  size_t dropped() const { return _dropped; }
+  std::filesystem::path dir() const { return _dir; }
+
+private:
+  static uint32_t length(const uint8_t *rec) {
+    uint32_t len;
+    std::memcpy(&len, rec, 4);
+    return len;
+  }
+
+  static size_t record_size(uint32_t len) { return (8 + size_t(len) + 7) & ~size_t(7); }
+
+  std::filesystem::path path(uint64_t index) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llu.seg", static_cast<unsigned long long>(index));
+    return _dir / name;
+  }
+
+  uint8_t *map(uint64_t index) {
+    int fd = ::open(path(index).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ::ftruncate(fd, _segment_size) != 0)
+      throw std::runtime_error("Cannot open spool segment " + path(index).string());
+    void *p = ::mmap(nullptr, _segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Cannot map spool segment " + path(index).string());
+    return static_cast<uint8_t *>(p);
+  }
+
+  void unmap(Segment &seg) {
+    if (seg.base) ::munmap(seg.base, _segment_size);
+    seg.base = nullptr;
+  }
+
+  // Moves the read position to the next segment when the current one is
+  // exhausted, deleting it. Returns false if there is nothing to read.
+  bool advance() {
+    while (true) {
+      bool at_end = _offset[1] + 8 > _segment_size || length(_read.base + _offset[1]) == 0;
+      if (!at_end) return true;
+      if (_read.index == _write.index) return false;
+      drop_read_segment();
+    }
+  }
+
+  void drop_read_segment() {
+    unmap(_read);
+    std::filesystem::remove(path(_read.index));
+    _segments.pop_front();
+    _read.index = _segments.front();
+    _read.base = _read.index == _write.index ? _write.base : map(_read.index);
+    _offset[0] = _read.index;
+    _offset[1] = 0;
+  }
+
+  // Starts a new write segment, dropping the oldest one if over budget
+  void roll() {
+    if (_write.base != _read.base) unmap(_write);
+    _write.index++;
+    _segments.push_back(_write.index);
+    _write.base = map(_write.index);
+    _write_pos = 0;
+    while (_segments.size() > _max_segments) {
+      // Count the unread records that are being lost
+      for (size_t pos = _offset[1]; pos + 8 <= _segment_size && length(_read.base + pos) != 0;
+           pos += record_size(length(_read.base + pos)))
+        _dropped++;
+      drop_read_segment();
+    }
+  }
+
+  std::filesystem::path _dir;
+  size_t _segment_size;
+  size_t _max_segments;
+  std::deque<uint64_t> _segments;
+  Segment _read, _write;
+  size_t _write_pos = 0;
+  uint64_t *_offset = nullptr; // mapped [segment index, offset in segment]
+  size_t _pushed = 0, _popped = 0, _dropped = 0;
+};
+
+#endif // SPOOL_HPP
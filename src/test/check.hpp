@@ -0,0 +1,48 @@
+/*
+   ____ _               _
+  / ___| |__   ___  ___| | __
+ | |   | '_ \ / _ \/ __| |/ /
+ | |___| | | |  __/ (__|   <
+  \____|_| |_|\___|\___|_|\_\
+ Minimal checks for the tests registered with CTest
+*/
+
+#ifndef CHECK_HPP
+#define CHECK_HPP
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+/*!
+ * Failed checks so far; a test returns it from main(), so that CTest sees
+ * a non-zero exit code
+ */
+inline int &check_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+/*!
+ * Reports a failed condition, with its source line, and goes on
+ */
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond     \
+                << std::endl;                                                  \
+      check_failures()++;                                                      \
+    }                                                                          \
+  } while (0)
+
+/*!
+ * An empty scratch directory under the system temporary directory
+ */
+inline std::filesystem::path scratch_dir(const std::string &name) {
+  std::filesystem::path dir = std::filesystem::temp_directory_path() / "mads-test" / name;
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+  return dir;
+}
+
+#endif // CHECK_HPP
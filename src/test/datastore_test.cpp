@@ -0,0 +1,140 @@
+/*
+  ____        _            _                   _            _
+ |  _ \  __ _| |_ __ _ ___| |_ ___  _ __ ___  | |_ ___  ___| |_
+ | | | |/ _` | __/ _` / __| __/ _ \| '__/ _ \ | __/ _ \/ __| __|
+ | |_| | (_| | || (_| \__ \ || (_) | | |  __/ | ||  __/\__ \ |_
+ |____/ \__,_|\__\__,_|___/\__\___/|_|  \___|  \__\___||___/\__|
+ Datastore recovery after a crash, and migration to MessagePack
+*/
+
+#include "../datastore.hpp"
+#include "check.hpp"
+#include <fstream>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Copies the files of a live store, as a crash would leave them
+static void snapshot_files(const Datastore &ds, const filesystem::path &to) {
+  filesystem::create_directories(to);
+  for (filesystem::path p : {filesystem::path(ds.path()), ds.journal_path()}) {
+    if (filesystem::exists(p))
+      filesystem::copy_file(p, to / p.filename(), filesystem::copy_options::overwrite_existing);
+  }
+}
+
+static size_t lines(const filesystem::path &path) {
+  ifstream ifs(path);
+  string line;
+  size_t n = 0;
+  while (getline(ifs, line)) n++;
+  return n;
+}
+
+int main() {
+  filesystem::path dir = scratch_dir("datastore");
+  json append = json::array({{{"op", "add"}, {"path", "/list/-"}, {"value", 2}}});
+
+  // a journal whose last line was cut by a crash: the complete entries are
+  // replayed, the partial one dropped, and new entries start on a new line
+  {
+    Datastore ds;
+    ds.prepare("cut", dir / "live" / "cut.json");
+    ds.set("a", 1);
+    ds.save();
+    ds.set("b", "two");
+    ds.save();
+    snapshot_files(ds, dir / "cut");
+  }
+  {
+    ofstream(dir / "cut" / "cut.json.journal", ios::app) << "[{\"op\":\"add\",\"pa";
+    Datastore ds;
+    ds.prepare("cut", dir / "cut" / "cut.json");
+    CHECK(ds.get("a") == 1);
+    CHECK(ds.get("b") == "two");
+    ds.set("c", 3);
+    ds.save();
+    CHECK(lines(ds.journal_path()) == 4); // header and three entries
+    snapshot_files(ds, dir / "cut2");
+  }
+  {
+    Datastore ds;
+    ds.prepare("cut", dir / "cut2" / "cut.json");
+    CHECK(ds.get("a") == 1 && ds.get("b") == "two" && ds.get("c") == 3);
+  }
+
+  // a crash during compaction, after the new snapshot replaced the old one
+  // but before the journal was reset: the stale journal is not replayed
+  {
+    Datastore ds;
+    ds.prepare("compact", dir / "live" / "compact.json");
+    ds.set("list", json::array({1}));
+    ds.save();
+    ds.compact();
+    ds.patch(append); // not idempotent: replaying it twice is visible
+    ds.save();
+    filesystem::path stale = dir / "stale.journal";
+    filesystem::copy_file(ds.journal_path(), stale);
+    ds.compact();
+    snapshot_files(ds, dir / "compact");
+    filesystem::copy_file(stale, dir / "compact" / "compact.json.journal",
+                          filesystem::copy_options::overwrite_existing);
+  }
+  {
+    Datastore ds;
+    ds.prepare("compact", dir / "compact" / "compact.json");
+    CHECK(ds.get("list") == json::array({1, 2}));
+    CHECK(lines(ds.journal_path()) == 1); // restarted for the new snapshot
+    ds.patch(append);
+    ds.save();
+    snapshot_files(ds, dir / "compact2");
+  }
+  {
+    Datastore ds;
+    ds.prepare("compact", dir / "compact2" / "compact.json");
+    CHECK(ds.get("list") == json::array({1, 2, 2}));
+  }
+
+  // a damaged journal header is treated as a stale journal
+  {
+    filesystem::copy_file(dir / "compact2" / "compact.json", dir / "compact" / "header.json");
+    ofstream(dir / "compact" / "header.json.journal") << "[1,2]\n[]\n";
+    Datastore ds;
+    ds.prepare("header", dir / "compact" / "header.json");
+    CHECK(ds.get("list").is_array());
+  }
+
+  // a JSON store, with pending journal entries, migrated to MessagePack
+  {
+    Datastore ds;
+    ds.prepare("store", dir / "live" / "store.json");
+    ds.set("x", 1.5);
+    ds.set("nested", {{"k", "v"}});
+    ds.save();
+    ds.compact();
+    ds.set("y", json::array({1, 2, 3}));
+    ds.save();
+    snapshot_files(ds, dir / "migrate");
+  }
+  {
+    Datastore ds;
+    ds.prepare("store", dir / "migrate" / "store.msgpack");
+    CHECK(ds.format() == "msgpack");
+    CHECK(ds.get("x") == 1.5);
+    CHECK(ds.get("/nested/k") == "v");
+    CHECK(ds.get("y") == json::array({1, 2, 3}));
+    CHECK(filesystem::exists(dir / "migrate" / "store.msgpack"));
+    CHECK(filesystem::exists(dir / "migrate" / "store.json.bak"));
+    CHECK(!filesystem::exists(dir / "migrate" / "store.json"));
+    CHECK(!filesystem::exists(dir / "migrate" / "store.json.journal"));
+    ds.set("z", true);
+  }
+  {
+    Datastore ds;
+    ds.prepare("store", dir / "migrate" / "store.msgpack");
+    CHECK(ds.get("z") == true && ds.get("x") == 1.5);
+  }
+
+  if (check_failures() == 0) cout << "datastore: ok" << endl;
+  return check_failures();
+}
@@ -0,0 +1,106 @@
+/*
+  ____  _             _         _           _             _            _
+ |  _ \| |_   _  __ _(_)_ __   (_)_ __   __| | _____  __ | |_ ___  ___| |_
+ | |_) | | | | |/ _` | | '_ \  | | '_ \ / _` |/ _ \ \/ / | __/ _ \/ __| __|
+ |  __/| | |_| | (_| | | | | | | | | | | (_| |  __/>  <  | ||  __/\__ \ |_
+ |_|   |_|\__,_|\__, |_|_| |_| |_|_| |_|\__,_|\___/_/\_\  \__\___||___/\__|
+                |___/
+ PluginIndex cache: reuse, invalidation on change, removal, protocol
+*/
+
+#include "../plugin_index.hpp"
+#include "check.hpp"
+#include <fstream>
+
+using namespace std;
+using json = nlohmann::json;
+
+// Copies a plugin as a new file, never over a file that may be loaded
+static void install(const filesystem::path &from, const filesystem::path &to) {
+  filesystem::remove(to);
+  filesystem::copy_file(from, to);
+}
+
+// Scans the directory with a fresh index, as a new process would
+static json scan(const filesystem::path &dir, const filesystem::path &cache,
+                 PluginIndex *out = nullptr) {
+  PluginIndex index(dir, cache);
+  CHECK(index.scan());
+  if (out) *out = index;
+  return index.stats();
+}
+
+int main(int argc, char const *argv[]) {
+  // plugin_index_test <filter plugin> <source plugin>, e.g. echoj and clock
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <echoj.plugin> <clock.plugin>" << endl;
+    return 1;
+  }
+  filesystem::path echoj = filesystem::absolute(argv[1]), clock = filesystem::absolute(argv[2]);
+  filesystem::path dir = scratch_dir("plugin_index"), cache = dir / "cache" / "index.json";
+  const string filter = Filter<>::server_name(), source = Source<>::server_name();
+  json s;
+
+  // first scan: the plugin is loaded, and the cache written
+  install(echoj, dir / "a.plugin");
+  PluginIndex index(dir, cache);
+  s = scan(dir, cache, &index);
+  CHECK(s["plugins"] == 1 && s["loaded"] == 1);
+  CHECK(filesystem::exists(cache));
+  CHECK(index.find(filter, "echoj") == dir / "a.plugin");
+  CHECK(index.find(source).empty());
+  CHECK(index.drivers(filter).size() == 1);
+
+  // unchanged: nothing is read
+  s = scan(dir, cache);
+  CHECK(s["cached"] == 1 && s["hashed"] == 0 && s["loaded"] == 0);
+
+  // touched, same content: hashed, not loaded
+  auto t = filesystem::last_write_time(dir / "a.plugin");
+  filesystem::last_write_time(dir / "a.plugin", t + chrono::seconds(10));
+  s = scan(dir, cache);
+  CHECK(s["cached"] == 0 && s["hashed"] == 1 && s["loaded"] == 0);
+  s = scan(dir, cache);
+  CHECK(s["cached"] == 1);
+
+  // a file that is not a plugin is indexed with no drivers, and loaded
+  // again once replaced (the dynamic loader keeps a library that was loaded
+  // once in this process, so the replacement is tested on a failed load)
+  ofstream(dir / "b.plugin") << "not a plugin";
+  s = scan(dir, cache, &index);
+  CHECK(s["plugins"] == 2 && s["loaded"] == 1);
+  CHECK(index.index()["plugins"]["b.plugin"]["drivers"].empty());
+  install(clock, dir / "b.plugin");
+  s = scan(dir, cache, &index);
+  CHECK(s["cached"] == 1 && s["loaded"] == 1);
+  CHECK(index.find(source, "clock") == dir / "b.plugin");
+
+  // removed plugins
+  filesystem::remove(dir / "a.plugin");
+  s = scan(dir, cache, &index);
+  CHECK(s["plugins"] == 1 && s["removed"] == 1 && s["loaded"] == 0);
+  CHECK(index.find(filter).empty());
+  CHECK(index.find(source, "clock") == dir / "b.plugin");
+
+  // a cache from another protocol version, or another directory, is ignored
+  json c = json::parse(ifstream(cache));
+  c["protocol"] = PLUGIN_PROTOCOL_VERSION - 1;
+  ofstream(cache) << c.dump();
+  s = scan(dir, cache);
+  CHECK(s["loaded"] == 1);
+  c = json::parse(ifstream(cache));
+  CHECK(c["protocol"] == PLUGIN_PROTOCOL_VERSION);
+  c["dir"] = "/elsewhere";
+  ofstream(cache) << c.dump();
+  s = scan(dir, cache);
+  CHECK(s["loaded"] == 1);
+  // and so is a damaged one
+  ofstream(cache) << "{\"protocol\":";
+  s = scan(dir, cache);
+  CHECK(s["loaded"] == 1);
+  s = scan(dir, cache);
+  CHECK(s["cached"] == 1);
+
+  if (check_failures() == 0) cout << "plugin index: ok" << endl;
+  return check_failures();
+}
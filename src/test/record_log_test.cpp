@@ -0,0 +1,79 @@
+/*
+  ____                        _   _               _            _
+ |  _ \ ___  ___ ___  _ __ __| | | | ___   __ _  | |_ ___  ___| |_
+ | |_) / _ \/ __/ _ \| '__/ _` | | |/ _ \ / _` | | __/ _ \/ __| __|
+ |  _ <  __/ (_| (_) | | | (_| | | | (_) | (_| | | ||  __/\__ \ |_
+ |_| \_\___|\___\___/|_|  \__,_| |_|\___/ \__, |  \__\___||___/\__|
+                                          |___/
+ RecordLog::Reader::seek() across segments, with empty and stray files
+*/
+
+#include "../record_log.hpp"
+#include "check.hpp"
+#include <cstdio>
+
+using namespace std;
+
+// Timestamp of the record after seek(t), or -1 at the end of the log
+static int64_t seek(RecordLog::Reader &r, int64_t t) {
+  RecordLog::Record rec;
+  r.seek(t);
+  return r.next(rec) ? rec.timestamp : -1;
+}
+
+static void touch(const filesystem::path &path) {
+  FILE *f = fopen(path.string().c_str(), "wb");
+  if (f) fclose(f);
+}
+
+int main() {
+  filesystem::path dir = scratch_dir("record_log");
+
+  // a writer that records nothing leaves no segment behind
+  { RecordLog::Writer w(dir); }
+  CHECK(RecordLog::segments(dir).empty());
+
+  // 200 records, 10 ns apart, 40 bytes each, in 4 KiB segments
+  {
+    RecordLog::Writer w(dir, 4096);
+    for (int i = 0; i < 200; i++) CHECK(w.append(i * 10, "t", to_string(i % 10)));
+  }
+  size_t written = RecordLog::segments(dir).size();
+  CHECK(written > 1);
+
+  // an empty segment at the end, as left by a crash, and a stray file
+  touch(RecordLog::segment_path(dir, 1000, "log"));
+  touch(dir / "notes.log");
+
+  RecordLog::Reader r(dir);
+  CHECK(r.segment_count() == written + 1);
+  CHECK(r.start_timestamp() == 0);
+  CHECK(seek(r, -5) == 0);
+  CHECK(seek(r, 5) == 10);
+  for (int64_t t = 0; t < 2000; t += 10) CHECK(seek(r, t) == t);
+  CHECK(seek(r, 1991) == -1);
+  CHECK(seek(r, 5000) == -1);
+
+  // all records are read in order, across segments
+  RecordLog::Record rec;
+  r.rewind();
+  int64_t n = 0;
+  while (r.next(rec)) CHECK(rec.timestamp == 10 * n++);
+  CHECK(n == 200);
+  CHECK(r.error().empty());
+
+  // empty segments at the start of the log
+  for (uint64_t i = written; i-- > 0;) {
+    for (const char *ext : {"log", "idx"})
+      filesystem::rename(RecordLog::segment_path(dir, i, ext), RecordLog::segment_path(dir, i + 2, ext));
+  }
+  touch(RecordLog::segment_path(dir, 0, "log"));
+  touch(RecordLog::segment_path(dir, 1, "log"));
+  RecordLog::Reader r2(dir);
+  CHECK(r2.start_timestamp() == 0);
+  for (int64_t t = 0; t < 2000; t += 10) CHECK(seek(r2, t) == t);
+  CHECK(seek(r2, 1991) == -1);
+
+  if (check_failures() == 0) cout << "record log: ok" << endl;
+  return check_failures();
+}
@@ -0,0 +1,142 @@
+/*
+  ____  _                        _       _                   _            _
+ / ___|| |__   __ _ _ __ ___  __| |  ___| |_ ___  _ __ ___  | |_ ___  ___| |_
+ \___ \| '_ \ / _` | '__/ _ \/ _` | / __| __/ _ \| '__/ _ \ | __/ _ \/ __| __|
+  ___) | | | | (_| | | |  __/ (_| | \__ \ || (_) | | |  __/ | ||  __/\__ \ |_
+ |____/|_| |_|\__,_|_|  \___|\__,_| |___/\__\___/|_|  \___|  \__\___||___/\__|
+ SharedDatastore lock-free readers racing writers, and damaged slots
+*/
+
+#include "../shared_datastore.hpp"
+#include "check.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+int main() {
+  filesystem::path path = scratch_dir("shared_datastore") / "race.shm";
+  const int writes = 2000, writers = 2, readers = 4;
+
+  // each state is consistent: n and -n, and a payload whose length depends
+  // on n, so that slots are regularly outgrown and the file remapped
+  {
+    SharedDatastore init;
+    init.prepare("race", path, 64);
+    init.set("n", 0);
+  }
+  atomic<bool> done{false};
+  atomic<long> reads{0}, torn{0}, errors{0};
+  vector<thread> threads;
+  for (int r = 0; r < readers; r++) {
+    threads.emplace_back([&] {
+      // one instance per thread: each has its own mapping and cache
+      SharedDatastore ds;
+      ds.prepare("race", path);
+      long last = 0;
+      while (!done) {
+        try {
+          auto s = ds.read();
+          long n = s->value("n", 0L);
+          if (n < last || s->value("check", 0L) != -n ||
+              s->value("pad", string()).size() != size_t(n % 1000))
+            torn++;
+          last = n;
+          reads++;
+        } catch (std::exception &) {
+          errors++;
+        }
+      }
+    });
+  }
+  vector<thread> writer_threads;
+  for (int w = 0; w < writers; w++) {
+    writer_threads.emplace_back([&] {
+      SharedDatastore ds;
+      ds.prepare("race", path);
+      for (int i = 0; i < writes; i++) {
+        ds.update([](json &s) {
+          long n = s.value("n", 0L) + 1;
+          s["n"] = n;
+          s["check"] = -n;
+          s["pad"] = string(n % 1000, 'x');
+        });
+      }
+    });
+  }
+  for (auto &t : writer_threads) t.join();
+  done = true;
+  for (auto &t : threads) t.join();
+
+  SharedDatastore ds;
+  ds.prepare("race", path);
+  // updates from different instances are serialized
+  CHECK(ds.get("n") == writers * writes);
+  CHECK(ds.version() == uint64_t(writers * writes + 1));
+  CHECK(reads > 0);
+  CHECK(torn == 0);
+  CHECK(errors == 0);
+
+  // wait() returns on a change from another instance, and right away when
+  // not prepared
+  uint64_t v = ds.version();
+  thread writer([&] {
+    SharedDatastore other;
+    other.prepare("race", path);
+    this_thread::sleep_for(chrono::milliseconds(20));
+    other.set("n", -1);
+  });
+  CHECK(ds.wait(v, chrono::seconds(5)) == v + 1);
+  writer.join();
+  SharedDatastore unprepared;
+  CHECK(unprepared.wait(0, chrono::seconds(5)) == 0);
+
+  // a failing callback does not stop the watcher, nor the other callbacks
+  atomic<int> notified{0};
+  ds.watch("n", [](const string &, const json &) { throw runtime_error("callback failure"); });
+  ds.watch("n", [&](const string &, const json &) { notified++; });
+  long n = 0;
+  {
+    // changes made before the watcher thread starts are not notified
+    SharedDatastore other;
+    other.prepare("race", path);
+    for (int i = 0; i < 200 && notified == 0; i++) {
+      other.set("n", --n);
+      this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    CHECK(notified > 0);
+    int before = notified;
+    other.set("n", --n);
+    for (int i = 0; i < 200 && notified == before; i++) this_thread::sleep_for(chrono::milliseconds(10));
+    CHECK(notified > before);
+  }
+
+  // damaged slots: a reader that has the last good state keeps it, a new
+  // one gets an error, and watching is still safe
+  CHECK(ds.get("n") == n);
+  {
+    FILE *f = fopen(path.c_str(), "r+b");
+    fseek(f, 0, SEEK_END);
+    vector<char> junk(ftell(f) - 128, char(0xc1));
+    fseek(f, 128, SEEK_SET);
+    fwrite(junk.data(), 1, junk.size(), f);
+    fclose(f);
+  }
+  CHECK(ds.get("n") == n);
+  SharedDatastore fresh;
+  fresh.prepare("race", path);
+  bool threw = false;
+  try {
+    fresh.read();
+  } catch (std::runtime_error &) {
+    threw = true;
+  }
+  CHECK(threw);
+  fresh.watch("n", [](const string &, const json &) {});
+  this_thread::sleep_for(chrono::milliseconds(150));
+
+  if (check_failures() == 0) cout << "shared datastore: ok" << endl;
+  return check_failures();
+}
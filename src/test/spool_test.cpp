@@ -0,0 +1,77 @@
+/*
+  ____                    _   _            _
+ / ___| _ __   ___   ___ | | | |_ ___  ___| |_
+ \___ \| '_ \ / _ \ / _ \| | | __/ _ \/ __| __|
+  ___) | |_) | (_) | (_) | | | ||  __/\__ \ |_
+ |____/| .__/ \___/ \___/|_|  \__\___||___/\__|
+       |_|
+ Spool FIFO order across segments, size bound, and restarts
+*/
+
+#include "../spool.hpp"
+#include "check.hpp"
+#include <string>
+
+using namespace std;
+
+static string payload(size_t i) { return "message " + to_string(i); }
+
+int main() {
+  filesystem::path dir = scratch_dir("spool");
+  string topic, data;
+
+  // records of 24 bytes in 256-byte segments: 10 per segment
+  {
+    Spool spool(dir, 256, 1 << 20);
+    CHECK(spool.empty());
+    CHECK(!spool.front(topic, data));
+    for (size_t i = 0; i < 35; i++) CHECK(spool.push("t", payload(i)));
+    CHECK(spool.disk_usage() == 4 * 256);
+    // read a part, across a segment boundary
+    for (size_t i = 0; i < 15; i++) {
+      CHECK(spool.front(topic, data));
+      CHECK(topic == "t" && data == payload(i));
+      spool.pop();
+    }
+    CHECK(spool.disk_usage() == 3 * 256); // the consumed segment is deleted
+    CHECK(!spool.push("t", string(300, 'x')));
+  }
+
+  // after a restart, reading resumes where it stopped, and writing appends
+  {
+    Spool spool(dir, 256, 1 << 20);
+    for (size_t i = 35; i < 40; i++) CHECK(spool.push("t", payload(i)));
+    for (size_t i = 15; i < 40; i++) {
+      CHECK(spool.front(topic, data));
+      CHECK(data == payload(i));
+      spool.pop();
+    }
+    CHECK(spool.empty());
+    CHECK(spool.popped() == 25);
+  }
+
+  // over the size bound (4 segments) the oldest segments are dropped
+  dir = scratch_dir("spool_bound");
+  {
+    Spool spool(dir, 256, 4 * 256);
+    for (size_t i = 0; i < 100; i++) CHECK(spool.push("t", payload(i)));
+    CHECK(spool.disk_usage() == 4 * 256);
+    CHECK(spool.dropped() == 60);
+    for (size_t i = 60; i < 100; i++) {
+      CHECK(spool.front(topic, data));
+      CHECK(data == payload(i));
+      spool.pop();
+    }
+    CHECK(spool.empty());
+    // and it keeps wrapping around after being drained
+    for (size_t i = 0; i < 25; i++) CHECK(spool.push("t", payload(i)));
+    for (size_t i = 0; i < 25; i++) {
+      CHECK(spool.front(topic, data) && data == payload(i));
+      spool.pop();
+    }
+    CHECK(spool.empty());
+  }
+
+  if (check_failures() == 0) cout << "spool: ok" << endl;
+  return check_failures();
+}
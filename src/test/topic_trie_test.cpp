@@ -0,0 +1,64 @@
+/*
+  _____           _        _        _        _            _
+ |_   _|__  _ __ (_) ___  | |_ _ __(_) ___  | |_ ___  ___| |_
+   | |/ _ \| '_ \| |/ __| | __| '__| |/ _ \ | __/ _ \/ __| __|
+   | | (_) | |_) | | (__  | |_| |  | |  __/ | ||  __/\__ \ |_
+   |_|\___/| .__/|_|\___|  \__|_|  |_|\___|  \__\___||___/\__|
+           |_|
+ TopicTrie matching with the MQTT wildcards '+' and '#', and '$' topics
+*/
+
+#include "../topic_trie.hpp"
+#include "check.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The filters matching a topic, sorted
+static vector<string> matching(const TopicTrie<string> &trie, const string &topic) {
+  vector<string> found;
+  size_t n = trie.match(topic, [&](const string &filter) { found.push_back(filter); });
+  CHECK(n == found.size());
+  sort(found.begin(), found.end());
+  return found;
+}
+
+int main() {
+  TopicTrie<string> trie;
+  for (string f : {"sensors/temp", "sensors/+", "sensors/#", "+/temp", "+/+/raw", "a/+/c",
+                   "$SYS/broker", "$SYS/#"})
+    trie.insert(f, f);
+  CHECK(trie.size() == 8);
+
+  using list = vector<string>;
+  // exact and single-level matches
+  CHECK(matching(trie, "sensors/temp") == (list{"+/temp", "sensors/#", "sensors/+", "sensors/temp"}));
+  CHECK(matching(trie, "sensors/hum") == (list{"sensors/#", "sensors/+"}));
+  CHECK(matching(trie, "room/temp") == (list{"+/temp"}));
+  // '+' matches exactly one level, possibly empty
+  CHECK(matching(trie, "a/b/c") == (list{"a/+/c"}));
+  CHECK(matching(trie, "a//c") == (list{"a/+/c"}));
+  CHECK(matching(trie, "a/b/c/d").empty());
+  CHECK(matching(trie, "x/y/raw") == (list{"+/+/raw"}));
+  // '#' matches any number of levels, and the parent level itself
+  CHECK(matching(trie, "sensors") == (list{"sensors/#"}));
+  CHECK(matching(trie, "sensors/a/b/c") == (list{"sensors/#"}));
+  CHECK(!trie.matches("other"));
+  CHECK(matching(trie, "sensorsX/temp") == (list{"+/temp"}));
+
+  // topics starting with '$' are not matched by leading wildcards
+  CHECK(matching(trie, "$SYS/broker") == (list{"$SYS/#", "$SYS/broker"}));
+  CHECK(matching(trie, "$SYS/temp") == (list{"$SYS/#"}));
+  TopicTrie<string> all;
+  all.insert("#", "#");
+  all.insert("+/x", "+/x");
+  CHECK(all.matches("a/x"));
+  CHECK(all.matches("a/b/c"));
+  CHECK(!all.matches("$SYS/x"));
+  CHECK(!all.matches("$SYS"));
+
+  if (check_failures() == 0) cout << "topic trie: ok" << endl;
+  return check_failures();
+}
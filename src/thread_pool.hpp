@@ -0,0 +1,148 @@
+/*
+  _____ _                        _   ____             _
+ |_   _| |__  _ __ ___  __ _  __| | |  _ \ ___   ___ | |
+   | | | '_ \| '__/ _ \/ _` |/ _` | | |_) / _ \ / _ \| |
+   | | | | | | | |  __/ (_| | (_| | |  __/ (_) | (_) | |
+   |_| |_| |_|_|  \___|\__,_|\__,_| |_|   \___/ \___/|_|
+
+ ThreadPool class, a fixed-size work-stealing thread pool
+*/
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * Fixed-size thread pool with work stealing
+ *
+ * Each thread owns a task deque. Tasks submitted from outside the pool are
+ * distributed round-robin; tasks submitted from a pool thread go to its own
+ * deque. A thread takes tasks from the back of its deque (most recent first,
+ * for cache locality) and, when that is empty, steals from the front of the
+ * other threads' deques, so that long tasks do not leave queued work behind
+ * while other threads are idle.
+ *
+ * The destructor runs the tasks still queued, then joins the threads.
+ */
+class ThreadPool {
+  struct Queue {
+    std::mutex mtx;
+    std::deque<std::function<void()>> tasks;
+  };
+
+public:
+  explicit ThreadPool(size_t threads = std::thread::hardware_concurrency()) {
+    threads = std::max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; i++)
+      _queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threads; i++)
+      _threads.emplace_back([this, i] { work(i); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto &t : _threads) t.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /*!
+   * Queues a task for execution
+   */
+  void submit(std::function<void()> task) {
+    size_t i = _index >= 0 && _owner == this ? _index : _next++ % _queues.size();
+    {
+      std::lock_guard<std::mutex> lock(_queues[i]->mtx);
+      _queues[i]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mtx);
+      _pending++;
+    }
+    _cv.notify_one();
+  }
+
+  /*!
+   * Number of threads
+   */
+  size_t size() const { return _threads.size(); }
+
+  /*!
+   * Number of tasks queued and not yet started
+   */
+  size_t pending() const { return _pending; }
+
+  /*!
+   * Number of tasks taken from another thread's queue
+   */
+  size_t steals() const { return _steals; }
+
+private:
+  void work(size_t i) {
+    _index = i;
+    _owner = this;
+    std::function<void()> task;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this] { return _stop || _pending > 0; });
+        if (_pending == 0) return; // stopping, and nothing left to do
+        _pending--;
+      }
+      // A task is reserved for this thread: find it, own queue first
+      while (!take(i, task)) std::this_thread::yield();
+      task();
+      task = nullptr;
+    }
+  }
+
+  bool take(size_t i, std::function<void()> &task) {
+    {
+      Queue &q = *_queues[i];
+      std::lock_guard<std::mutex> lock(q.mtx);
+      if (!q.tasks.empty()) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t k = 1; k < _queues.size(); k++) {
+      Queue &q = *_queues[(i + k) % _queues.size()];
+      std::lock_guard<std::mutex> lock(q.mtx);
+      if (!q.tasks.empty()) {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+        _steals++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<std::unique_ptr<Queue>> _queues;
+  std::vector<std::thread> _threads;
+  std::mutex _mtx;
+  std::condition_variable _cv;
+  std::atomic<size_t> _pending{0};
+  std::atomic<size_t> _next{0};
+  std::atomic<size_t> _steals{0};
+  bool _stop = false;
+  static inline thread_local long _index = -1;
+  static inline thread_local ThreadPool *_owner = nullptr;
+};
+
+#endif // THREAD_POOL_HPP
@@ -0,0 +1,141 @@
+/*
+  _____ _      _
+ |_   _(_) ___| | _____ _ __
+   | | | |/ __| |/ / _ \ '__|
+   | | | | (__|   <  __/ |
+   |_| |_|\___|_|\_\___|_|
+
+ Ticker class, a drift-free periodic scheduler based on absolute deadlines
+*/
+
+#ifndef TICKER_HPP
+#define TICKER_HPP
+
+#include "histogram.hpp"
+#include <chrono>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <cerrno>
+#include <time.h>
+#endif
+
+/*!
+ * Periodic scheduler with absolute deadlines
+ *
+ * Each deadline is computed by adding the period to the previous deadline,
+ * rather than to the time when the previous iteration ended, so that the
+ * time spent in the loop body and the sleep inaccuracies do not accumulate
+ * into drift. On Linux, it sleeps with `clock_nanosleep(TIMER_ABSTIME)` on
+ * the monotonic clock.
+ *
+ * When an iteration overruns past one or more deadlines, the policy decides
+ * what happens:
+ * - `catch_up`: the missed ticks are fired back-to-back, without sleeping,
+ *   so that the average rate is preserved;
+ * - `skip`: the missed ticks are dropped, and the schedule continues at the
+ *   next deadline in the future.
+ *
+ * The lateness of each wake-up with respect to its deadline (jitter) is
+ * collected in a histogram, in microseconds.
+ */
+class Ticker {
+public:
+  using clock = std::chrono::steady_clock;
+
+  enum class overrun_policy { catch_up, skip };
+
+  Ticker(std::chrono::nanoseconds period, overrun_policy policy = overrun_policy::skip)
+      : _period(period), _policy(policy), _jitter(0.1, 1e7) {
+    start();
+  }
+
+  /*!
+   * Restarts the schedule: the first deadline is one period from now
+   */
+  void start() {
+    _deadline = clock::now();
+    _overruns = 0;
+    _ticks = 0;
+  }
+
+  /*!
+   * Sleeps until the next deadline. Returns the number of ticks that have
+   * been skipped because of an overrun (always 0 with `catch_up`).
+   */
+  size_t wait() {
+    _deadline += _period;
+    size_t skipped = 0;
+    auto now = clock::now();
+    if (now > _deadline) {
+      _overruns++;
+      if (_policy == overrun_policy::skip && _period.count() > 0) {
+        skipped = (now - _deadline) / _period + 1;
+        _deadline += _period * skipped;
+      }
+    }
+    sleep_until(_deadline);
+    std::chrono::duration<double, std::micro> late = clock::now() - _deadline;
+    _jitter.add(late.count());
+    _ticks++;
+    return skipped;
+  }
+
+  /*!
+   * Changes the period, starting from the next deadline
+   */
+  void set_period(std::chrono::nanoseconds period) { _period = period; }
+
+  std::chrono::nanoseconds period() const { return _period; }
+
+  /*!
+   * The deadline of the last tick
+   */
+  clock::time_point deadline() const { return _deadline; }
+
+  /*!
+   * Number of iterations that ended after the following deadline
+   */
+  size_t overruns() const { return _overruns; }
+
+  size_t ticks() const { return _ticks; }
+
+  /*!
+   * Histogram of wake-up lateness, in microseconds
+   */
+  const Histogram &jitter() const { return _jitter; }
+
+  /*!
+   * Parses an overrun policy name ("skip" or "catch_up")
+   */
+  static overrun_policy policy(const std::string &name) {
+    return name == "catch_up" ? overrun_policy::catch_up : overrun_policy::skip;
+  }
+
+  /*!
+   * Sleeps until an absolute time on the steady clock
+   */
+  static void sleep_until(clock::time_point t) {
+#ifdef __linux__
+    // On Linux, steady_clock is CLOCK_MONOTONIC
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+    if (ns <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#else
+    std::this_thread::sleep_until(t);
+#endif
+  }
+
+private:
+  std::chrono::nanoseconds _period;
+  overrun_policy _policy;
+  clock::time_point _deadline;
+  size_t _overruns = 0;
+  size_t _ticks = 0;
+  Histogram _jitter;
+};
+
+#endif // TICKER_HPP
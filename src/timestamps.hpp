@@ -0,0 +1,154 @@
+/*
+  _____ _                     _
+ |_   _(_)_ __ ___   ___  ___| |_ __ _ _ __ ___  _ __  ___
+   | | | | '_ ` _ \ / _ \/ __| __/ _` | '_ ` _ \| '_ \/ __|
+   | | | | | | | | |  __/\__ \ || (_| | | | | | | |_) \__ \
+   |_| |_|_| |_| |_|\___||___/\__\__,_|_| |_| |_| .__/|___/
+                                                |_|
+ Timestamps class, stamping messages along the pipeline for latency analysis
+*/
+
+#ifndef TIMESTAMPS_HPP
+#define TIMESTAMPS_HPP
+
+#include <nlohmann/json.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#ifndef _WIN32
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/*!
+ * Per-hop timestamps of a message
+ *
+ * Timestamps are stored in the `timestamps` array of a JSON message, one
+ * entry per stage (source, filters, sink), in the order the message went
+ * through them:
+ *
+ * ```json
+ * "timestamps": [
+ *   {"stage": "clock", "host": "edge1", "departure": {"steady": ..., "system": ..., "tai": ...}},
+ *   {"stage": "echoj", "host": "edge1", "arrival": {...}, "departure": {...}},
+ *   {"stage": "to_console", "host": "srv", "arrival": {...}}
+ * ]
+ * ```
+ *
+ * Each time is given in nanoseconds for the `steady` clock (monotonic, not
+ * affected by NTP adjustments, but only comparable on the same host), the
+ * `system` clock, and the `tai` clock, where available (Linux).
+ */
+class Timestamps {
+public:
+  /*!
+   * Current time on all the available clocks, in ns
+   */
+  static nlohmann::json clocks() {
+    using namespace std::chrono;
+    nlohmann::json j = {
+      {"steady", duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count()},
+      {"system", duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count()}
+    };
+#ifdef CLOCK_TAI
+    struct timespec ts;
+    if (clock_gettime(CLOCK_TAI, &ts) == 0)
+      j["tai"] = static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+#endif
+    return j;
+  }
+
+  /*!
+   * Host name, used to tell whether steady clock times are comparable
+   */
+  static const std::string &host() {
+    static const std::string name = [] {
+#ifdef _WIN32
+      const char *h = std::getenv("COMPUTERNAME");
+      return std::string(h ? h : "");
+#else
+      char h[256] = {0};
+      gethostname(h, sizeof(h) - 1);
+      return std::string(h);
+#endif
+    }();
+    return name;
+  }
+
+  /*!
+   * Appends a hop for the given stage with its arrival time
+   */
+  static void arrive(nlohmann::json &msg, const std::string &stage) {
+    nlohmann::json &ts = msg["timestamps"];
+    if (!ts.is_array()) ts = nlohmann::json::array();
+    ts.push_back({{"stage", stage}, {"host", host()}, {"arrival", clocks()}});
+  }
+
+  /*!
+   * Sets the departure time of the given stage: if the last hop belongs to
+   * this stage, it is completed (or updated), otherwise a new hop is appended
+   * (as for sources)
+   */
+  static void depart(nlohmann::json &msg, const std::string &stage) {
+    nlohmann::json &ts = msg["timestamps"];
+    if (!ts.is_array()) ts = nlohmann::json::array();
+    if (ts.empty() || ts.back().value("stage", "") != stage)
+      ts.push_back({{"stage", stage}, {"host", host()}});
+    ts.back()["departure"] = clocks();
+  }
+
+  /*!
+   * Decomposes the latency of a message into transit times (between the
+   * departure from a stage and the arrival to the next one) and processing
+   * times (between arrival and departure within a stage), in ms.
+   * Transit times between different hosts use the TAI clock if available on
+   * both, otherwise the system clock.
+   */
+  static nlohmann::json latency(const nlohmann::json &msg) {
+    nlohmann::json result = {{"segments", nlohmann::json::array()}, {"total", 0.0}};
+    if (!msg.contains("timestamps") || !msg["timestamps"].is_array()) return result;
+    const nlohmann::json &ts = msg["timestamps"];
+    double total = 0;
+    for (size_t i = 0; i < ts.size(); i++) {
+      const nlohmann::json &hop = ts[i];
+      // a previous stage with no time at all gives no transit segment
+      const nlohmann::json *from = i > 0 ? last_time(ts[i - 1]) : nullptr;
+      if (from && hop.contains("arrival")) {
+        const nlohmann::json &prev = ts[i - 1];
+        bool same_host = prev.value("host", "") == hop.value("host", "");
+        double dt = elapsed(*from, hop["arrival"], same_host);
+        result["segments"].push_back({
+          {"from", prev.value("stage", "")}, {"to", hop.value("stage", "")},
+          {"kind", "transit"}, {"ms", dt}
+        });
+        total += dt;
+      }
+      if (hop.contains("arrival") && hop.contains("departure")) {
+        double dt = elapsed(hop["arrival"], hop["departure"], true);
+        result["segments"].push_back({
+          {"from", hop.value("stage", "")}, {"to", hop.value("stage", "")},
+          {"kind", "processing"}, {"ms", dt}
+        });
+        total += dt;
+      }
+    }
+    result["total"] = total;
+    return result;
+  }
+
+private:
+  // The departure time of a stage, or its arrival time, or null
+  static const nlohmann::json *last_time(const nlohmann::json &stage) {
+    if (stage.contains("departure")) return &stage["departure"];
+    if (stage.contains("arrival")) return &stage["arrival"];
+    return nullptr;
+  }
+
+  static double elapsed(const nlohmann::json &from, const nlohmann::json &to, bool same_host) {
+    const char *clock = same_host ? "steady" :
+                        (from.contains("tai") && to.contains("tai")) ? "tai" : "system";
+    return (to[clock].get<long long>() - from[clock].get<long long>()) / 1.0e6;
+  }
+};
+
+#endif // TIMESTAMPS_HPP
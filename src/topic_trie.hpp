@@ -0,0 +1,120 @@
+/*
+  _____           _        _____     _
+ |_   _|__  _ __ (_) ___  |_   _| __(_) ___
+   | |/ _ \| '_ \| |/ __|   | || '__| |/ _ \
+   | | (_) | |_) | | (__    | || |  | |  __/
+   |_|\___/| .__/|_|\___|   |_||_|  |_|\___|
+           |_|
+ TopicTrie class, matching MQTT topics against wildcard filters
+*/
+
+#ifndef TOPIC_TRIE_HPP
+#define TOPIC_TRIE_HPP
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*!
+ * Trie of MQTT topic filters
+ *
+ * Filters are split into levels at '/' and stored in a trie, where the
+ * single-level wildcard '+' and the multi-level wildcard '#' are dedicated
+ * branches. Matching a topic then costs one lookup per level, regardless of
+ * the number of filters, rather than comparing the topic with every filter.
+ *
+ * Wildcards follow the MQTT rules: "a/#" also matches "a", and topics
+ * starting with '$' are not matched by filters starting with a wildcard.
+ *
+ * @tparam T the value associated to each filter
+ */
+template <typename T>
+class TopicTrie {
+  struct Node {
+    std::unordered_map<std::string, std::unique_ptr<Node>> children;
+    std::unique_ptr<Node> plus;
+    std::vector<T> values;      // filters ending at this level
+    std::vector<T> hash_values; // filters ending with '#' after this level
+  };
+
+public:
+  /*!
+   * Adds a filter, associating it to a value
+   */
+  void insert(std::string_view filter, T value) {
+    Node *node = &_root;
+    size_t pos = 0;
+    while (true) {
+      size_t slash = filter.find('/', pos);
+      std::string_view level = filter.substr(pos, slash == std::string_view::npos ? std::string_view::npos : slash - pos);
+      if (level == "#") {
+        node->hash_values.push_back(std::move(value));
+        break;
+      }
+      std::unique_ptr<Node> &next = level == "+" ? node->plus : node->children[std::string(level)];
+      if (!next) next = std::make_unique<Node>();
+      node = next.get();
+      if (slash == std::string_view::npos) {
+        node->values.push_back(std::move(value));
+        break;
+      }
+      pos = slash + 1;
+    }
+    _size++;
+  }
+
+  /*!
+   * Calls f(value) for each filter matching the topic. Returns the number of
+   * matches.
+   */
+  template <typename F>
+  size_t match(std::string_view topic, F &&f) const {
+    return match(&_root, topic, 0, !topic.empty() && topic[0] == '$', f);
+  }
+
+  /*!
+   * Returns true if at least a filter matches the topic
+   */
+  bool matches(std::string_view topic) const {
+    return match(topic, [](const T &) {}) > 0;
+  }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+private:
+  template <typename F>
+  static size_t match(const Node *node, std::string_view topic, size_t pos, bool system, F &f) {
+    size_t n = 0;
+    // '#' matches the remaining levels, and the parent level too
+    if (!system) {
+      for (auto &v : node->hash_values) {
+        f(v);
+        n++;
+      }
+    }
+    if (pos > topic.size()) {
+      for (auto &v : node->values) {
+        f(v);
+        n++;
+      }
+      return n;
+    }
+    size_t slash = topic.find('/', pos);
+    size_t end = slash == std::string_view::npos ? topic.size() : slash;
+    std::string_view level = topic.substr(pos, end - pos);
+    auto it = node->children.find(std::string(level));
+    if (it != node->children.end())
+      n += match(it->second.get(), topic, end + 1, false, f);
+    if (node->plus && !system)
+      n += match(node->plus.get(), topic, end + 1, false, f);
+    return n;
+  }
+
+  Node _root;
+  size_t _size = 0;
+};
+
+#endif // TOPIC_TRIE_HPP